@@ -0,0 +1,264 @@
+// ConcurrentHashList.h
+// vim: set ts=4 sw=4 et:
+
+#ifndef ConcurrentHashList_H_
+#define ConcurrentHashList_H_ 1
+
+#if __cplusplus < 201103L
+  #error ConcurrentHashList.h needs c++11 (std::mutex)
+#endif
+
+#include <mutex>
+#include <thread>
+#include "HashList.h"
+
+namespace tony {
+
+//==========================================================
+// TConcurrentHashList -- THashList split into locked shards
+//
+// Every key belongs to one of Shards() independent THashList, chosen by the
+// high bits of its hash, each behind its own mutex. Even Find() writes
+// (HitCount, MRUFirst, FOverMaxDeeps) so a shard is always locked
+// exclusively; threads only wait on each other when they hit the same
+// shard. Resize and LimitCount eviction happen per shard.
+//==========================================================
+
+const size_t CONCURRENT_SHARDS_PER_THREAD = 4;  // default Shards()
+
+template <typename _Tp, typename _Sizer = TPrimeSize, typename _Hash = TFNVHash>
+class TConcurrentHashList {
+    public:
+        typedef THashList<_Tp,_Sizer,_Hash> TList;
+
+        // Shards: rounded up to a power of 2, 0 for
+        // CONCURRENT_SHARDS_PER_THREAD * hardware threads.
+        // HashSize and LimitCount are for the whole list.
+        TConcurrentHashList(size_t HashSize=0, size_t LimitCount=0, size_t Shards=0);
+        ~TConcurrentHashList();
+        void Clear();
+        void GetStatistics(double& density, double& AvgDeeps, int& MaxDeeps) const;
+        bool Add(const TKeyRef& Key, const _Tp& Value);
+        bool Delete(const TKeyRef& Key);
+        bool Find(const TKeyRef& Key) const;
+        bool Find(const TKeyRef& Key, _Tp& Value) const;
+        template <typename _Fn>
+        bool Merge(const TKeyRef& Key, const _Tp& Value, _Fn Combine);
+        bool Increment(const TKeyRef& Key, const _Tp& Delta=1) { return Merge(Key,Delta,TMergeAdd()); }
+        size_t Count() const;
+        size_t HashSize() const;
+        size_t Shards() const { return FShardCount; }
+
+        // Settings of every shard, see THashList
+        void MRUFirst(bool Enable);
+        void HitCounting(THitCounting Mode);
+        void EvictPolicy(TEvictPolicy Policy);
+        void Admission(bool Enable);
+        void max_load_factor(double factor, double avgDeeps=0, int maxDeeps=0);
+
+        // Run Fn(TList&) on each shard with its lock held
+        template <typename _Fn>
+        void ForEachShard(_Fn Fn);
+
+        // c++11 compatiable
+        void clear() { Clear(); }
+        bool empty() const { return size() == 0; }
+        size_t size() const { return Count(); }
+        size_t bucket_count() const { return HashSize(); }
+    private:
+        struct alignas(64) TShard {
+            mutable std::mutex  Lock;
+            TList               List;
+            TShard(size_t HashSize, size_t LimitCount) : List(HashSize,LimitCount) {}
+        };
+        typedef std::lock_guard<std::mutex> TGuard;
+
+        TShard** FShards;       // TShard*[FShardCount]
+        size_t  FShardCount;    // power of 2
+        int     FShardBits;     // log2(FShardCount)
+        _Hash   FHash;          // Key -> shard, by the high bits
+
+        TShard& ShardOf(const TKeyRef& Key) const {
+            if (FShardBits == 0) return *FShards[0];
+            size_t Hash = FHash(Key.Data,Key.Size);
+            return *FShards[Hash >> (sizeof(size_t)*8 - FShardBits)];
+        }
+
+        TConcurrentHashList(const TConcurrentHashList&);
+        TConcurrentHashList& operator=(const TConcurrentHashList&);
+};
+
+//==========================================================
+// TConcurrentHashList -- Implement
+//==========================================================
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+TConcurrentHashList<_Tp,_Sizer,_Hash>::TConcurrentHashList(size_t HashSize, size_t LimitCount, size_t Shards)
+{
+    if (Shards == 0) {
+        size_t Threads = std::thread::hardware_concurrency();
+        Shards = CONCURRENT_SHARDS_PER_THREAD * (Threads > 0 ? Threads : 1);
+    }
+    FShardCount = 1;
+    FShardBits = 0;
+    while (FShardCount < Shards) {
+        FShardCount <<= 1;
+        FShardBits++;
+    }
+
+    // Round LimitCount up, a shard may not get 0 (no limit)
+    size_t ShardLimit = (LimitCount + FShardCount - 1) / FShardCount;
+    FShards = new TShard*[FShardCount];
+    for (size_t i = 0; i < FShardCount; i++) {
+        FShards[i] = new TShard(HashSize / FShardCount,ShardLimit);
+    }
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+TConcurrentHashList<_Tp,_Sizer,_Hash>::~TConcurrentHashList()
+{
+    for (size_t i = 0; i < FShardCount; i++) {
+        delete FShards[i];
+    }
+    delete[] FShards;
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+template <typename _Fn>
+void TConcurrentHashList<_Tp,_Sizer,_Hash>::ForEachShard(_Fn Fn)
+{
+    for (size_t i = 0; i < FShardCount; i++) {
+        TGuard Guard(FShards[i]->Lock);
+        Fn(FShards[i]->List);
+    }
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TConcurrentHashList<_Tp,_Sizer,_Hash>::Clear()
+{
+    ForEachShard([](TList& List) { List.Clear(); });
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TConcurrentHashList<_Tp,_Sizer,_Hash>::MRUFirst(bool Enable)
+{
+    ForEachShard([Enable](TList& List) { List.MRUFirst = Enable; });
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TConcurrentHashList<_Tp,_Sizer,_Hash>::HitCounting(THitCounting Mode)
+{
+    ForEachShard([Mode](TList& List) { List.HitCounting = Mode; });
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TConcurrentHashList<_Tp,_Sizer,_Hash>::EvictPolicy(TEvictPolicy Policy)
+{
+    ForEachShard([Policy](TList& List) { List.EvictPolicy = Policy; });
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TConcurrentHashList<_Tp,_Sizer,_Hash>::Admission(bool Enable)
+{
+    ForEachShard([Enable](TList& List) { List.Admission(Enable); });
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TConcurrentHashList<_Tp,_Sizer,_Hash>::max_load_factor(double factor, double avgDeeps, int maxDeeps)
+{
+    ForEachShard([=](TList& List) { List.max_load_factor(factor,avgDeeps,maxDeeps); });
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool TConcurrentHashList<_Tp,_Sizer,_Hash>::Add(const TKeyRef& Key, const _Tp& Value)
+{
+    TShard& Shard = ShardOf(Key);
+    TGuard Guard(Shard.Lock);
+    return Shard.List.Add(Key,Value);
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool TConcurrentHashList<_Tp,_Sizer,_Hash>::Delete(const TKeyRef& Key)
+{
+    TShard& Shard = ShardOf(Key);
+    TGuard Guard(Shard.Lock);
+    return Shard.List.Delete(Key);
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool TConcurrentHashList<_Tp,_Sizer,_Hash>::Find(const TKeyRef& Key) const
+{
+    TShard& Shard = ShardOf(Key);
+    TGuard Guard(Shard.Lock);
+    return Shard.List.Find(Key);
+}
+
+// Value is copied out under the lock
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool TConcurrentHashList<_Tp,_Sizer,_Hash>::Find(const TKeyRef& Key, _Tp& Value) const
+{
+    TShard& Shard = ShardOf(Key);
+    TGuard Guard(Shard.Lock);
+    return Shard.List.Find(Key,Value);
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+template <typename _Fn>
+bool TConcurrentHashList<_Tp,_Sizer,_Hash>::Merge(const TKeyRef& Key, const _Tp& Value, _Fn Combine)
+{
+    TShard& Shard = ShardOf(Key);
+    TGuard Guard(Shard.Lock);
+    return Shard.List.Merge(Key,Value,Combine);
+}
+
+// Sum of the shards, each read under its lock: exact only when no other
+// thread is writing
+template <typename _Tp, typename _Sizer, typename _Hash>
+size_t TConcurrentHashList<_Tp,_Sizer,_Hash>::Count() const
+{
+    size_t Result = 0;
+    for (size_t i = 0; i < FShardCount; i++) {
+        TGuard Guard(FShards[i]->Lock);
+        Result += FShards[i]->List.Count();
+    }
+    return Result;
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+size_t TConcurrentHashList<_Tp,_Sizer,_Hash>::HashSize() const
+{
+    size_t Result = 0;
+    for (size_t i = 0; i < FShardCount; i++) {
+        TGuard Guard(FShards[i]->Lock);
+        Result += FShards[i]->List.HashSize();
+    }
+    return Result;
+}
+
+// As if the shards were one THashList: density and AvgDeeps are weighted
+// by the shards' sizes, MaxDeeps is the deepest chain of any shard
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TConcurrentHashList<_Tp,_Sizer,_Hash>::GetStatistics(double& density, double& AvgDeeps, int& MaxDeeps) const
+{
+    double nBucketLoad = 0;
+    size_t nHashSize = 0;
+    size_t nCount = 0;
+    MaxDeeps = 0;
+    for (size_t i = 0; i < FShardCount; i++) {
+        TGuard Guard(FShards[i]->Lock);
+        const TList& List = FShards[i]->List;
+        double d, a;
+        int m;
+        List.GetStatistics(d,a,m);
+        nBucketLoad += d * List.HashSize();
+        nHashSize += List.HashSize();
+        nCount += List.Count();
+        if (m > MaxDeeps) MaxDeeps = m;
+    }
+
+    density = nHashSize > 0 ? nBucketLoad / nHashSize : 0;
+    AvgDeeps = nBucketLoad > 0 ? nCount / nBucketLoad : 0;
+}
+
+}   // namespace tony
+#endif
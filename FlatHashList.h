@@ -0,0 +1,504 @@
+// FlatHashList.h
+// vim: set ts=4 sw=4 et:
+
+#ifndef FlatHashList_H_
+#define FlatHashList_H_ 1
+
+#include <new>
+#include <algorithm>
+#include "HashList.h"
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+namespace tony {
+
+//==========================================================
+// TFlatHashList -- open addressing (SwissTable layout)
+//
+// Slots live in one flat array. A parallel array of control bytes keeps a
+// 7-bit tag of each slot's hash (or EMPTY/DELETED), and lookups compare a
+// whole group of FLAT_GROUP_SIZE tags at once, so only the slots whose tag
+// matches are touched. No Link/Next/Prev pointers, no per-entry new().
+//==========================================================
+
+const signed char FLAT_EMPTY    = -128;     // 0x80: never used
+const signed char FLAT_DELETED  = -2;       // 0xFE: tombstone
+const int FLAT_GROUP_SIZE       = 16;
+const double FLAT_MAX_LOAD      = 0.875;    // 14 of 16 slots per group
+
+struct TFlatGroup {
+    const signed char* Ctrl;
+
+    explicit TFlatGroup(const signed char* P) : Ctrl(P) {}
+
+#if defined(__SSE2__)
+    // Bit i is set when Ctrl[i] == Tag
+    unsigned Match(signed char Tag) const {
+        __m128i G = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Ctrl));
+        return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(G,_mm_set1_epi8(Tag)));
+    }
+    // EMPTY and DELETED are the only negative control bytes
+    unsigned MatchFree() const {
+        __m128i G = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Ctrl));
+        return (unsigned)_mm_movemask_epi8(G);
+    }
+#else
+    unsigned Match(signed char Tag) const {
+        unsigned Result = 0;
+        for (int i = 0; i < FLAT_GROUP_SIZE; i++) {
+            if (Ctrl[i] == Tag) Result |= 1u << i;
+        }
+        return Result;
+    }
+    unsigned MatchFree() const {
+        unsigned Result = 0;
+        for (int i = 0; i < FLAT_GROUP_SIZE; i++) {
+            if (Ctrl[i] < 0) Result |= 1u << i;
+        }
+        return Result;
+    }
+#endif
+    unsigned MatchEmpty() const { return Match(FLAT_EMPTY); }
+};
+
+template <typename _Tp>
+struct TFlatSlot {
+    string      Key;
+    _Tp         Value;
+};
+
+template <typename _Tp, typename _Hash = TFNVHash>
+class TFlatHashList {
+    public:
+        TFlatHashList(size_t HashSize=0);
+        TFlatHashList(const TFlatHashList& Source);
+        ~TFlatHashList();
+        void Assign(const TFlatHashList& Source);
+        void Clear();
+        void GetStatistics(double& density, double& AvgDeeps, int& MaxDeeps) const;
+        bool Add(const TKeyRef& Key, const _Tp& Value);
+        bool Delete(const TKeyRef& Key);
+        bool Delete(int Index) { return Delete(GetSlot(Index)->Key); }
+        bool Find(const TKeyRef& Key) const;
+        bool Find(const TKeyRef& Key, _Tp& Value) const;
+        int IndexOf(const TKeyRef& Key) const;
+        bool Resize(size_t HashSize);
+        const string& Keys(int Index) const { return GetSlot(Index)->Key; }
+        const _Tp& Values(int Index) const { return GetSlot(Index)->Value; }
+        size_t Count() const { return FCount; }
+        size_t HashSize() const { return FCapacity; }
+
+        // c++11 compatiable
+        TFlatHashList& operator=(const TFlatHashList& Source);
+        _Tp& operator[](const TKeyRef& Key);
+        void clear() { Clear(); }
+        bool empty() const { return size() == 0; }
+        bool rehash(size_t HashSize) { return Resize(HashSize); }
+        size_t bucket_count() const { return FCapacity; }
+        size_t size() const { return FCount; }
+        const _Hash& hash_function() const { return FHash; }
+        double load_factor() const { return (double)FCount / FCapacity; }
+        double max_load_factor() const { return FMaxLoadFactor; }
+        void max_load_factor(double factor, double avgDeeps=0, int maxDeeps=0);
+    protected:
+        size_t HashKey(const TKeyRef& Key) const;
+    private:
+        typedef TFlatSlot<_Tp>* PSlot;
+
+        signed char* FCtrl;     // Control bytes: FLAT_EMPTY, FLAT_DELETED or 7-bit tag
+        PSlot   FSlots;         // Slots[FCapacity], constructed only where FCtrl[] >= 0
+        size_t  FCapacity;      // power of 2, multiple of FLAT_GROUP_SIZE
+        size_t  FCount;         // full slots
+        size_t  FDeleted;       // tombstones
+        size_t  FGrowthLeft;    // EMPTY slots we may still fill before Resize()
+        double  FMaxLoadFactor; // 0.5 ~ FLAT_MAX_LOAD
+        _Hash   FHash;          // Key -> Hash, see THashList
+
+        // Cache for Keys()/Values() ...
+        mutable int     FLastIndex;
+        mutable size_t  FLastPos;
+
+        static signed char Tag(size_t Hash) { return (signed char)(Hash & 0x7F); }
+        size_t Groups() const { return FCapacity / FLAT_GROUP_SIZE; }
+        size_t MaxCount(size_t Capacity) const { return (size_t)(Capacity * FMaxLoadFactor); }
+        size_t ToCapacity(size_t HashSize) const;
+        void Allocate(size_t Capacity);
+        void Destroy();
+        bool Find0(const TKeyRef& Key, size_t Hash, size_t& Pos) const;
+        size_t FindFree(size_t Hash) const;
+        size_t Insert0(const TKeyRef& Key, size_t Hash);
+        void Erase(size_t Pos);
+        PSlot GetSlot(const int Index) const;
+};
+
+//==========================================================
+// TFlatHashList -- Implement
+//==========================================================
+
+template <typename _Tp, typename _Hash>
+TFlatHashList<_Tp,_Hash>::TFlatHashList(size_t HashSize)
+{
+    FMaxLoadFactor = FLAT_MAX_LOAD;
+    FCount = 0;
+    Allocate(ToCapacity(HashSize));
+}
+
+template <typename _Tp, typename _Hash>
+TFlatHashList<_Tp,_Hash>::TFlatHashList(const TFlatHashList& Source)
+    :   FHash(Source.FHash)
+{
+    FMaxLoadFactor = Source.FMaxLoadFactor;
+    FCount = 0;
+    Allocate(ToCapacity(Source.FCapacity));
+    Assign(Source);
+}
+
+template <typename _Tp, typename _Hash>
+TFlatHashList<_Tp,_Hash>& TFlatHashList<_Tp,_Hash>::operator=(const TFlatHashList& Source)
+{
+    if (this != &Source) {
+        Assign(Source);
+    }
+    return *this;
+}
+
+template <typename _Tp, typename _Hash>
+TFlatHashList<_Tp,_Hash>::~TFlatHashList()
+{
+    Destroy();
+}
+
+// Power of 2 >= HashSize, large enough to keep FCount under FMaxLoadFactor
+template <typename _Tp, typename _Hash>
+size_t TFlatHashList<_Tp,_Hash>::ToCapacity(size_t HashSize) const
+{
+    size_t N = FLAT_GROUP_SIZE;
+    while (N < HashSize || MaxCount(N) <= FCount) N <<= 1;
+    return N;
+}
+
+template <typename _Tp, typename _Hash>
+void TFlatHashList<_Tp,_Hash>::Allocate(size_t Capacity)
+{
+    FCapacity = Capacity;
+    FCtrl = new signed char[Capacity];
+    memset(FCtrl,FLAT_EMPTY,Capacity);
+    FSlots = static_cast<PSlot>(operator new(Capacity * sizeof(TFlatSlot<_Tp>)));
+    FCount = 0;
+    FDeleted = 0;
+    FGrowthLeft = MaxCount(Capacity);
+
+    FLastIndex = -1;
+    FLastPos = 0;
+}
+
+template <typename _Tp, typename _Hash>
+void TFlatHashList<_Tp,_Hash>::Destroy()
+{
+    for (size_t i = 0; FCount > 0 && i < FCapacity; i++) {
+        if (FCtrl[i] >= 0) {
+            FSlots[i].~TFlatSlot<_Tp>();
+            FCount--;
+        }
+    }
+    operator delete(FSlots);
+    delete[] FCtrl;
+    FSlots = nullptr;
+    FCtrl = nullptr;
+}
+
+template <typename _Tp, typename _Hash>
+void TFlatHashList<_Tp,_Hash>::Assign(const TFlatHashList& Source)
+{
+    FMaxLoadFactor = Source.FMaxLoadFactor;
+    Clear();
+    Resize(Source.FCapacity);
+    for (size_t i = 0; i < Source.FCapacity; i++) {
+        if (Source.FCtrl[i] >= 0) {
+            Add(Source.FSlots[i].Key,Source.FSlots[i].Value);
+        }
+    }
+}
+
+template <typename _Tp, typename _Hash>
+void TFlatHashList<_Tp,_Hash>::Clear()
+{
+    for (size_t i = 0; FCount > 0 && i < FCapacity; i++) {
+        if (FCtrl[i] >= 0) {
+            FSlots[i].~TFlatSlot<_Tp>();
+            FCount--;
+        }
+    }
+    memset(FCtrl,FLAT_EMPTY,FCapacity);
+    FCount = 0;
+    FDeleted = 0;
+    FGrowthLeft = MaxCount(FCapacity);
+    FLastIndex = -1;
+}
+
+template <typename _Tp, typename _Hash>
+size_t TFlatHashList<_Tp,_Hash>::HashKey(const TKeyRef& Key) const
+{
+    size_t Result = FHash(Key.Data,Key.Size);
+
+    // Tag uses the low 7 bits and the group the rest: mix high bits down
+    Result ^= Result >> 33;
+    Result *= 0xff51afd7ed558ccdULL;
+    Result ^= Result >> 33;
+    return Result;
+}
+
+template <typename _Tp, typename _Hash>
+bool TFlatHashList<_Tp,_Hash>::Find0(const TKeyRef& Key, size_t Hash, size_t& Pos) const
+{
+    const signed char T = Tag(Hash);
+    const size_t Mask = Groups() - 1;
+    size_t g = (Hash >> 7) & Mask;
+    for (size_t i = 1; ; i++) {
+        const size_t Base = g * FLAT_GROUP_SIZE;
+        TFlatGroup Group(FCtrl + Base);
+        for (unsigned M = Group.Match(T); M != 0; M &= M - 1) {
+            size_t P = Base + __builtin_ctz(M);
+            if (Key == FSlots[P].Key) {
+                Pos = P;
+                return true;
+            }
+        }
+        // An EMPTY slot ends the probe sequence
+        if (Group.MatchEmpty() != 0) return false;
+        g = (g + i) & Mask;     // triangular probing visits every group
+        if (i > Mask) return false;
+    }
+}
+
+template <typename _Tp, typename _Hash>
+size_t TFlatHashList<_Tp,_Hash>::FindFree(size_t Hash) const
+{
+    const size_t Mask = Groups() - 1;
+    size_t g = (Hash >> 7) & Mask;
+    for (size_t i = 1; ; i++) {
+        const size_t Base = g * FLAT_GROUP_SIZE;
+        unsigned M = TFlatGroup(FCtrl + Base).MatchFree();
+        if (M != 0) return Base + __builtin_ctz(M);
+        g = (g + i) & Mask;
+    }
+}
+
+template <typename _Tp, typename _Hash>
+size_t TFlatHashList<_Tp,_Hash>::Insert0(const TKeyRef& Key, size_t Hash)
+{
+    size_t Pos = FindFree(Hash);
+    if (FGrowthLeft == 0 && FCtrl[Pos] == FLAT_EMPTY) {
+        // Drop tombstones, and grow if they were not the problem
+        Resize(FCount >= MaxCount(FCapacity) / 2 ? FCapacity * 2 : FCapacity);
+        Pos = FindFree(Hash);
+    }
+
+    if (FCtrl[Pos] == FLAT_EMPTY) {
+        FGrowthLeft--;
+    } else {
+        FDeleted--;
+    }
+    FCtrl[Pos] = Tag(Hash);
+    new (&FSlots[Pos]) TFlatSlot<_Tp>();
+    FSlots[Pos].Key.assign(Key.Data,Key.Size);
+    FCount++;
+    FLastIndex = -1;
+    return Pos;
+}
+
+template <typename _Tp, typename _Hash>
+void TFlatHashList<_Tp,_Hash>::Erase(size_t Pos)
+{
+    FSlots[Pos].~TFlatSlot<_Tp>();
+    FCount--;
+
+    // A group that still has an EMPTY slot never made any probe move on,
+    // so the slot can go straight back to EMPTY instead of a tombstone.
+    const size_t Base = Pos & ~(size_t)(FLAT_GROUP_SIZE - 1);
+    if (TFlatGroup(FCtrl + Base).MatchEmpty() != 0) {
+        FCtrl[Pos] = FLAT_EMPTY;
+        FGrowthLeft++;
+    } else {
+        FCtrl[Pos] = FLAT_DELETED;
+        FDeleted++;
+    }
+    FLastIndex = -1;
+}
+
+// Return true if add success, false if Key alreay exists!
+template <typename _Tp, typename _Hash>
+bool TFlatHashList<_Tp,_Hash>::Add(const TKeyRef& Key, const _Tp& Value)
+{
+    size_t Hash = HashKey(Key);
+    size_t Pos;
+    if (Find0(Key,Hash,Pos)) return false;
+
+    Pos = Insert0(Key,Hash);
+    FSlots[Pos].Value = Value;
+    return true;
+}
+
+template <typename _Tp, typename _Hash>
+bool TFlatHashList<_Tp,_Hash>::Delete(const TKeyRef& Key)
+{
+    size_t Pos;
+    bool Result = Find0(Key,HashKey(Key),Pos);
+    if (Result) Erase(Pos);
+    return Result;
+}
+
+template <typename _Tp, typename _Hash>
+bool TFlatHashList<_Tp,_Hash>::Find(const TKeyRef& Key) const
+{
+    size_t Pos;
+    return Find0(Key,HashKey(Key),Pos);
+}
+
+template <typename _Tp, typename _Hash>
+bool TFlatHashList<_Tp,_Hash>::Find(const TKeyRef& Key, _Tp& Value) const
+{
+    size_t Pos;
+    bool Result = Find0(Key,HashKey(Key),Pos);
+    if (Result) {
+        Value = FSlots[Pos].Value;
+    }
+    return Result;
+}
+
+template <typename _Tp, typename _Hash>
+_Tp& TFlatHashList<_Tp,_Hash>::operator[](const TKeyRef& Key)
+{
+    size_t Hash = HashKey(Key);
+    size_t Pos;
+    if (!Find0(Key,Hash,Pos)) {
+        Pos = Insert0(Key,Hash);
+        FSlots[Pos].Value = Empty_<_Tp>();
+    }
+    return FSlots[Pos].Value;
+}
+
+template <typename _Tp, typename _Hash>
+int TFlatHashList<_Tp,_Hash>::IndexOf(const TKeyRef& Key) const
+{
+    size_t Pos;
+    if (!Find0(Key,HashKey(Key),Pos)) return -1;
+
+    int Result = 0;
+    for (size_t i = 0; i < Pos; i++) {
+        if (FCtrl[i] >= 0) Result++;
+    }
+    FLastIndex = Result;
+    FLastPos = Pos;
+    return Result;
+}
+
+template <typename _Tp, typename _Hash>
+typename TFlatHashList<_Tp,_Hash>::PSlot TFlatHashList<_Tp,_Hash>::GetSlot(const int Index) const
+{
+    if (Index < 0 || Index >= FCount) {
+        throw new runtime_error(Format("TFlatHashList.GetSlot> Index out of bounds (%d).",Index));
+    }
+
+    // Slots are in hash order: walk forward, from the cache when we can
+    int n = 0;
+    size_t Pos = 0;
+    if (FLastIndex >= 0 && FLastIndex <= Index) {
+        n = FLastIndex;
+        Pos = FLastPos;
+    } else {
+        while (FCtrl[Pos] < 0) Pos++;
+    }
+    while (n < Index) {
+        do Pos++; while (FCtrl[Pos] < 0);
+        n++;
+    }
+
+    // Caches result
+    FLastIndex = Index;
+    FLastPos = Pos;
+    return &FSlots[Pos];
+}
+
+template <typename _Tp, typename _Hash>
+bool TFlatHashList<_Tp,_Hash>::Resize(size_t HashSize)
+{
+    HashSize = ToCapacity(HashSize);
+    if (HashSize == FCapacity && FDeleted == 0) return false;
+
+    signed char* XCtrl = FCtrl;
+    PSlot XSlots = FSlots;
+    size_t XCapacity = FCapacity;
+
+    Allocate(HashSize);
+
+    // Move full slots from XSlots[] to FSlots[]
+    for (size_t i = 0; i < XCapacity; i++) {
+        if (XCtrl[i] >= 0) {
+            PSlot Src = &XSlots[i];
+            size_t Hash = HashKey(Src->Key);
+            size_t Pos = FindFree(Hash);
+            FCtrl[Pos] = Tag(Hash);
+            FGrowthLeft--;
+            PSlot Dst = new (&FSlots[Pos]) TFlatSlot<_Tp>();
+            Dst->Key.swap(Src->Key);
+            std::swap(Dst->Value,Src->Value);
+            Src->~TFlatSlot<_Tp>();
+            FCount++;
+        }
+    }
+
+    operator delete(XSlots);
+    delete[] XCtrl;
+    return true;
+}
+
+template <typename _Tp, typename _Hash>
+void TFlatHashList<_Tp,_Hash>::max_load_factor(double factor, double /*avgDeeps*/, int /*maxDeeps*/)
+{
+    // avgDeeps/maxDeeps are chain hints of THashList: nothing to tune here
+    if (factor < 0.5) factor = 0.5;
+    if (factor > FLAT_MAX_LOAD) factor = FLAT_MAX_LOAD;
+    FMaxLoadFactor = factor;
+    if (FCount + FDeleted >= MaxCount(FCapacity)) {
+        Resize(FCapacity);
+    } else {
+        FGrowthLeft = MaxCount(FCapacity) - FCount - FDeleted;
+    }
+}
+
+// density: full slots ratio; AvgDeeps/MaxDeeps: groups probed to find a key
+template <typename _Tp, typename _Hash>
+void TFlatHashList<_Tp,_Hash>::GetStatistics(double& density, double& AvgDeeps, int& MaxDeeps) const
+{
+    const size_t Mask = Groups() - 1;
+    size_t nTotal = 0;
+    int nMaxDeeps = 0;
+    for (size_t Pos = 0; Pos < FCapacity; Pos++) {
+        if (FCtrl[Pos] < 0) continue;
+        size_t Hash = HashKey(FSlots[Pos].Key);
+        size_t g = (Hash >> 7) & Mask;
+        int nDeeps = 1;
+        for (size_t i = 1; g != Pos / FLAT_GROUP_SIZE; i++) {
+            g = (g + i) & Mask;
+            nDeeps++;
+        }
+        if (nDeeps > nMaxDeeps) nMaxDeeps = nDeeps;
+        nTotal += nDeeps;
+    }
+
+    if (FCount > 0) {
+        density = (double)FCount / FCapacity;
+        AvgDeeps = (double)nTotal / FCount;
+        MaxDeeps = nMaxDeeps;
+    } else {
+        density = 0;
+        AvgDeeps = 0;
+        MaxDeeps = 0;
+    }
+}
+
+}   // namespace tony
+#endif
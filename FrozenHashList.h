@@ -0,0 +1,273 @@
+// FrozenHashList.h
+// vim: set ts=4 sw=4 et:
+
+#ifndef FrozenHashList_H_
+#define FrozenHashList_H_ 1
+
+#include <vector>
+#include "HashList.h"
+
+namespace tony {
+
+//==========================================================
+// TFrozenHashList -- immutable copy of a THashList, found in one probe
+//
+// Freeze() builds a minimal perfect hash of the keys (PTHash): keys fall
+// into buckets, and each bucket gets the first pilot that sends all of its
+// keys to free positions in [0, Count). A lookup hashes the key once,
+// reads its bucket's pilot, and compares the one key at that position. No
+// chains, no Link/HitCount, no spare slots: keys are packed in one buffer,
+// values in one array, both by position.
+//
+// Keys(i)/Values(i) are in hash order, not in the insertion order of the
+// source list.
+//==========================================================
+
+const double FROZEN_BUCKET_KEYS = 3;    // average keys per bucket
+const unsigned FROZEN_MAX_PILOT = 1u << 30;
+const int FROZEN_MAX_SEEDS  = 16;       // Freeze() gives up after so many
+
+template <typename _Tp>
+class TFrozenHashList {
+    public:
+        TFrozenHashList() : FHash(0), FCount(0), FBuckets(0), FDenseBuckets(0) {}
+        template <typename _Sizer, typename _Hash>
+        explicit TFrozenHashList(const THashList<_Tp,_Sizer,_Hash>& Source)
+            : FHash(0), FCount(0), FBuckets(0), FDenseBuckets(0) { Freeze(Source); }
+        template <typename _Sizer, typename _Hash>
+        void Freeze(const THashList<_Tp,_Sizer,_Hash>& Source);
+        void Clear();
+        bool Find(const TKeyRef& Key) const { return IndexOf(Key) >= 0; }
+        bool Find(const TKeyRef& Key, _Tp& Value) const;
+        int IndexOf(const TKeyRef& Key) const;
+        const string Keys(int Index) const;
+        const _Tp& Values(int Index) const { return FValues[CheckIndex(Index)]; }
+        size_t Count() const { return FCount; }
+        size_t Buckets() const { return FBuckets; }
+        uint64_t Seed() const { return FHash.Seed(); }
+
+        // c++11 compatiable
+        void clear() { Clear(); }
+        bool empty() const { return size() == 0; }
+        size_t size() const { return FCount; }
+        const TWyHash& hash_function() const { return FHash; }
+    private:
+        TWyHash FHash;          // seeded, reseeded by Freeze() until it works
+        size_t  FCount;
+        size_t  FBuckets;       // length of FPilots[]
+        size_t  FDenseBuckets;  // the first 30% of buckets get 60% of keys
+        std::vector<uint32_t> FPilots;
+        std::vector<uint32_t> FKeyOffsets;  // [FCount+1] into FKeys
+        std::vector<char>     FKeys;
+        std::vector<_Tp>      FValues;
+
+        static uint64_t Mix(uint64_t x) {
+            x ^= x >> 33;
+            x *= UINT64_C(0xff51afd7ed558ccd);
+            x ^= x >> 33;
+            x *= UINT64_C(0xc4ceb9fe1a85ec53);
+            x ^= x >> 33;
+            return x;
+        }
+        // x * n / 2^64: a uniform x scaled to [0, n)
+        static size_t Scale(uint64_t x, size_t n) {
+#if defined(__SIZEOF_INT128__)
+            return static_cast<size_t>(((__uint128_t)x * n) >> 64);
+#else
+            return static_cast<size_t>(x % n);
+#endif
+        }
+        size_t BucketOf(uint64_t Hash) const {
+            uint32_t Low = static_cast<uint32_t>(Hash);
+            if ((Hash >> 32) < UINT64_C(0x99999999)) {     // 60%
+                return static_cast<size_t>(((uint64_t)Low * FDenseBuckets) >> 32);
+            }
+            return FDenseBuckets + static_cast<size_t>(((uint64_t)Low * (FBuckets - FDenseBuckets)) >> 32);
+        }
+        size_t PositionOf(uint64_t Hash, uint32_t Pilot) const {
+            return Scale(Mix(Hash ^ Mix(Pilot + UINT64_C(0x9E3779B97F4A7C15))),FCount);
+        }
+        bool Build(const std::vector<uint64_t>& Hashes, std::vector<size_t>& Position);
+        size_t CheckIndex(int Index) const;
+};
+
+//==========================================================
+// TFrozenHashList -- Implement
+//==========================================================
+
+template <typename _Tp>
+template <typename _Sizer, typename _Hash>
+void TFrozenHashList<_Tp>::Freeze(const THashList<_Tp,_Sizer,_Hash>& Source)
+{
+    Clear();
+    size_t Count = Source.Count();
+    if (Count >= std::numeric_limits<uint32_t>::max()) {
+        throw new runtime_error(Format("TFrozenHashList.Freeze> Too many keys (%zu).",Count));
+    }
+
+    std::vector<string> Keys(Count);
+    for (size_t i = 0; i < Count; i++) Keys[i] = Source.Keys(i);
+
+    // Seeds from the source's hash: a frozen copy of the same list gets the
+    // same layout
+    uint64_t Seed = Source.hash_function().Seed();
+    std::vector<uint64_t> Hashes(Count);
+    std::vector<size_t> Position;
+    int Tries = 0;
+    for (;;) {
+        FHash = TWyHash(Seed);
+        for (size_t i = 0; i < Count; i++) {
+            Hashes[i] = FHash(Keys[i].data(),Keys[i].size());
+        }
+        if (Build(Hashes,Position)) break;
+        if (++Tries == FROZEN_MAX_SEEDS) {
+            Clear();
+            throw new runtime_error(Format("TFrozenHashList.Freeze> No perfect hash for %zu keys.",Count));
+        }
+        Seed = Mix(Seed + Tries);
+    }
+
+    // Keys and values in the order of their positions
+    std::vector<size_t> KeyAt(Count);
+    size_t Bytes = 0;
+    for (size_t i = 0; i < Count; i++) {
+        KeyAt[Position[i]] = i;
+        Bytes += Keys[i].size();
+    }
+    if (Bytes >= std::numeric_limits<uint32_t>::max()) {
+        Clear();
+        throw new runtime_error(Format("TFrozenHashList.Freeze> Keys too long (%zu bytes).",Bytes));
+    }
+    FKeys.reserve(Bytes);
+    FKeyOffsets.resize(Count+1);
+    FValues.reserve(Count);
+    for (size_t n = 0; n < Count; n++) {
+        const string& Key = Keys[KeyAt[n]];
+        FKeyOffsets[n] = FKeys.size();
+        FKeys.insert(FKeys.end(),Key.begin(),Key.end());
+        FValues.push_back(Source.Values(KeyAt[n]));
+    }
+    FKeyOffsets[Count] = FKeys.size();
+}
+
+// Pilot search, buckets with the most keys first while positions are
+// easy to find. Position[i] is where key i goes. Return false to try
+// another seed: two keys with one hash, or a bucket with no pilot.
+template <typename _Tp>
+bool TFrozenHashList<_Tp>::Build(const std::vector<uint64_t>& Hashes, std::vector<size_t>& Position)
+{
+    size_t Count = Hashes.size();
+    FCount = Count;
+    FBuckets = (size_t)(Count / FROZEN_BUCKET_KEYS) + 1;
+    FDenseBuckets = (size_t)(FBuckets * 0.3) + 1;
+    if (FDenseBuckets >= FBuckets) FBuckets = FDenseBuckets + 1;
+    FPilots.assign(FBuckets,0);
+    Position.assign(Count,0);
+    if (Count == 0) return true;
+
+    // Keys of each bucket: Members[First[b]..First[b+1])
+    std::vector<size_t> First(FBuckets+1,0);
+    for (size_t i = 0; i < Count; i++) First[BucketOf(Hashes[i])+1]++;
+    for (size_t b = 0; b < FBuckets; b++) First[b+1] += First[b];
+    std::vector<size_t> Members(Count);
+    std::vector<size_t> Next(First.begin(),First.end()-1);
+    for (size_t i = 0; i < Count; i++) Members[Next[BucketOf(Hashes[i])]++] = i;
+
+    // Buckets by size, largest first
+    size_t MaxSize = 0;
+    for (size_t b = 0; b < FBuckets; b++) {
+        if (First[b+1] - First[b] > MaxSize) MaxSize = First[b+1] - First[b];
+    }
+    std::vector<size_t> BySize(MaxSize+2,0);
+    for (size_t b = 0; b < FBuckets; b++) BySize[MaxSize - (First[b+1] - First[b]) + 1]++;
+    for (size_t s = 0; s <= MaxSize; s++) BySize[s+1] += BySize[s];
+    std::vector<size_t> Order(FBuckets);
+    for (size_t b = 0; b < FBuckets; b++) Order[BySize[MaxSize - (First[b+1] - First[b])]++] = b;
+
+    std::vector<bool> Taken(Count,false);
+    std::vector<size_t> Pos(MaxSize);
+    for (size_t o = 0; o < FBuckets; o++) {
+        size_t b = Order[o];
+        size_t Size = First[b+1] - First[b];
+        if (Size == 0) break;
+        const size_t* Keys = &Members[First[b]];
+
+        uint32_t Pilot = 0;
+        for (;; Pilot++) {
+            if (Pilot == FROZEN_MAX_PILOT) return false;
+            size_t k = 0;
+            for (; k < Size; k++) {
+                size_t p = PositionOf(Hashes[Keys[k]],Pilot);
+                if (Taken[p]) break;
+                size_t j = 0;
+                while (j < k && Pos[j] != p) j++;
+                if (j < k) {
+                    // Same hash: no pilot can split them
+                    if (Hashes[Keys[j]] == Hashes[Keys[k]]) return false;
+                    break;
+                }
+                Pos[k] = p;
+            }
+            if (k == Size) break;
+        }
+
+        FPilots[b] = Pilot;
+        for (size_t k = 0; k < Size; k++) {
+            Taken[Pos[k]] = true;
+            Position[Keys[k]] = Pos[k];
+        }
+    }
+    return true;
+}
+
+template <typename _Tp>
+void TFrozenHashList<_Tp>::Clear()
+{
+    FCount = 0;
+    FBuckets = 0;
+    FDenseBuckets = 0;
+    FPilots.clear();
+    FKeyOffsets.clear();
+    FKeys.clear();
+    FValues.clear();
+}
+
+template <typename _Tp>
+int TFrozenHashList<_Tp>::IndexOf(const TKeyRef& Key) const
+{
+    if (FCount == 0) return -1;
+    uint64_t Hash = FHash(Key.Data,Key.Size);
+    size_t n = PositionOf(Hash,FPilots[BucketOf(Hash)]);
+    size_t Size = FKeyOffsets[n+1] - FKeyOffsets[n];
+    if (Size == Key.Size && (Size == 0 || memcmp(&FKeys[FKeyOffsets[n]],Key.Data,Size) == 0)) return (int)n;
+    return -1;
+}
+
+template <typename _Tp>
+bool TFrozenHashList<_Tp>::Find(const TKeyRef& Key, _Tp& Value) const
+{
+    int Index = IndexOf(Key);
+    if (Index < 0) return false;
+    Value = FValues[Index];
+    return true;
+}
+
+template <typename _Tp>
+const string TFrozenHashList<_Tp>::Keys(int Index) const
+{
+    size_t n = CheckIndex(Index);
+    if (FKeyOffsets[n+1] == FKeyOffsets[n]) return string();
+    return string(&FKeys[FKeyOffsets[n]],FKeyOffsets[n+1] - FKeyOffsets[n]);
+}
+
+template <typename _Tp>
+size_t TFrozenHashList<_Tp>::CheckIndex(int Index) const
+{
+    if (Index < 0 || (size_t)Index >= FCount) {
+        throw new runtime_error(Format("TFrozenHashList.CheckIndex> Index out of bounds (%d).",Index));
+    }
+    return Index;
+}
+
+}   // namespace tony
+#endif
@@ -7,8 +7,25 @@
 #include <string>
 #include <limits>
 #include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdexcept>
+#include <new>
 #include <assert.h>
+#include <stdint.h>
+#include <time.h>
+#include <stddef.h>
+#include <iterator>
+#include <vector>
+#if __cplusplus >= 201103L
+  #include <thread>
+  #include <system_error>
+  #include <utility>
+#endif
+#if __cplusplus >= 201703L
+  #include <string_view>
+#endif
 
 size_t Primes[] = {
     127, 251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521, 131071,
@@ -94,15 +111,445 @@ char* Empty_<char*>()
     return nullptr;
 }
 
+//--------------------------------------------------------------------
+// TKeyArena: key storage owned by one THashList
+//
+// Keys are carved from KEY_ARENA_BLOCK sized blocks and recycled through
+// free lists of 8-byte size classes, so Add() never calls malloc per key.
+// Keys longer than KEY_ARENA_MAX_SMALL get their own block which is
+// returned to the system as soon as the key is released.
+//--------------------------------------------------------------------
+const size_t KEY_ARENA_BLOCK        = 64 * 1024;
+const size_t KEY_ARENA_ALIGN        = 8;
+const size_t KEY_ARENA_MAX_SMALL    = 256;
+
+class TKeyArena {
+    public:
+        TKeyArena() : FBlocks(nullptr), FLarge(nullptr), FPos(nullptr), FEnd(nullptr) {
+            memset(FFree,0,sizeof(FFree));
+        }
+        ~TKeyArena() { Reset(); }
+        char* Alloc(size_t Size);
+        void Free(char* P, size_t Size);
+        void Reset();       // Release all blocks at once
+    private:
+        struct TBlock {
+            TBlock* Next;
+            TBlock* Prev;   // used by large blocks only
+        };
+        enum { SMALL_CLASSES = KEY_ARENA_MAX_SMALL / KEY_ARENA_ALIGN };
+
+        TBlock* FBlocks;    // Single-Linked list of KEY_ARENA_BLOCK blocks
+        TBlock* FLarge;     // Double-Linked list of large keys
+        char*   FPos;       // Bump pointer into FBlocks
+        char*   FEnd;
+        char*   FFree[SMALL_CLASSES];   // Free lists by size class
+
+        TKeyArena(const TKeyArena&);
+        TKeyArena& operator=(const TKeyArena&);
+};
+
+inline char* TKeyArena::Alloc(size_t Size)
+{
+    Size = (Size + KEY_ARENA_ALIGN - 1) & ~(KEY_ARENA_ALIGN - 1);
+    if (Size > KEY_ARENA_MAX_SMALL) {
+        TBlock* Block = static_cast<TBlock*>(malloc(sizeof(TBlock) + Size));
+        if (Block == nullptr) throw bad_alloc();
+        Block->Prev = nullptr;
+        Block->Next = FLarge;
+        if (FLarge != nullptr) FLarge->Prev = Block;
+        FLarge = Block;
+        return reinterpret_cast<char*>(Block + 1);
+    }
+
+    // Recycled key of the same size class?
+    char*& Free = FFree[Size / KEY_ARENA_ALIGN - 1];
+    if (Free != nullptr) {
+        char* Result = Free;
+        memcpy(&Free,Result,sizeof(char*));
+        return Result;
+    }
+
+    if (FPos + Size > FEnd) {
+        TBlock* Block = static_cast<TBlock*>(malloc(KEY_ARENA_BLOCK));
+        if (Block == nullptr) throw bad_alloc();
+        Block->Next = FBlocks;
+        FBlocks = Block;
+        FPos = reinterpret_cast<char*>(Block + 1);
+        FEnd = reinterpret_cast<char*>(Block) + KEY_ARENA_BLOCK;
+    }
+    char* Result = FPos;
+    FPos += Size;
+    return Result;
+}
+
+inline void TKeyArena::Free(char* P, size_t Size)
+{
+    Size = (Size + KEY_ARENA_ALIGN - 1) & ~(KEY_ARENA_ALIGN - 1);
+    if (Size > KEY_ARENA_MAX_SMALL) {
+        TBlock* Block = reinterpret_cast<TBlock*>(P) - 1;
+        if (Block->Prev != nullptr) Block->Prev->Next = Block->Next;
+        else FLarge = Block->Next;
+        if (Block->Next != nullptr) Block->Next->Prev = Block->Prev;
+        free(Block);
+        return;
+    }
+
+    // Insert P at front of its FreeList
+    char*& Free = FFree[Size / KEY_ARENA_ALIGN - 1];
+    memcpy(P,&Free,sizeof(char*));
+    Free = P;
+}
+
+inline void TKeyArena::Reset()
+{
+    TBlock* Lists[2] = { FBlocks, FLarge };
+    for (int i = 0; i < 2; i++) {
+        TBlock* Block = Lists[i];
+        while (Block != nullptr) {
+            TBlock* P = Block;
+            Block = Block->Next;
+            free(P);
+        }
+    }
+    FBlocks = nullptr;
+    FLarge = nullptr;
+    FPos = nullptr;
+    FEnd = nullptr;
+    memset(FFree,0,sizeof(FFree));
+}
+
+//--------------------------------------------------------------------
+// TKeyStr: bucket key, length stored inline
+//
+// Keys shorter than KEY_INLINE_SIZE are kept inside the bucket itself (one
+// cache line with Link/HitCount); longer keys point into the TKeyArena of
+// the owner list. Always '\0' terminated for c_str().
+//--------------------------------------------------------------------
+const size_t KEY_INLINE_SIZE = 16;
+
+class TKeyStr {
+    public:
+        TKeyStr() : FSize(0) { FBuf[0] = 0; }
+        size_t size() const { return FSize; }
+        bool empty() const { return FSize == 0; }
+        const char* data() const { return IsInline() ? FBuf : Ptr(); }
+        const char* c_str() const { return data(); }
+        operator string() const { return string(data(),FSize); }
+        bool Equals(const char* P, size_t Size) const {
+            return Size == FSize && memcmp(data(),P,Size) == 0;
+        }
+        bool operator==(const string& S) const { return Equals(S.data(),S.size()); }
+        bool operator!=(const string& S) const { return !Equals(S.data(),S.size()); }
+        bool operator==(const TKeyStr& S) const { return Equals(S.data(),S.size()); }
+        bool operator!=(const TKeyStr& S) const { return !Equals(S.data(),S.size()); }
+        void Assign(TKeyArena& Arena, const char* P, size_t Size);
+        void Release(TKeyArena& Arena);
+    private:
+        unsigned    FSize;
+        char        FBuf[KEY_INLINE_SIZE];  // Inline key, or char* at FBuf+4
+
+        bool IsInline() const { return FSize < KEY_INLINE_SIZE; }
+        char* Ptr() const {
+            char* P;
+            memcpy(&P,FBuf+4,sizeof(P));
+            return P;
+        }
+
+        TKeyStr(const TKeyStr&);
+        TKeyStr& operator=(const TKeyStr&);
+};
+
+inline bool operator==(const string& S, const TKeyStr& Key) { return Key == S; }
+inline bool operator!=(const string& S, const TKeyStr& Key) { return Key != S; }
+
+//--------------------------------------------------------------------
+// TKeyRef: key argument of THashList, pointer and length only
+//
+// Built implicitly from string, const char*, TKeyStr (or string_view), so a
+// lookup from a char buffer never makes a temporary string; Add() copies
+// the bytes straight into the bucket's TKeyStr.
+//--------------------------------------------------------------------
+struct TKeyRef {
+    const char* Data;
+    size_t      Size;
+
+    TKeyRef(const char* P, size_t N) : Data(P), Size(N) {}
+    TKeyRef(const char* P) : Data(P), Size(strlen(P)) {}
+    TKeyRef(const string& S) : Data(S.data()), Size(S.size()) {}
+    TKeyRef(const TKeyStr& S) : Data(S.data()), Size(S.size()) {}
+#if __cplusplus >= 201703L
+    TKeyRef(std::string_view S) : Data(S.data()), Size(S.size()) {}
+#endif
+    bool operator==(const string& S) const {
+        return Size == S.size() && memcmp(Data,S.data(),Size) == 0;
+    }
+};
+
+inline void TKeyStr::Assign(TKeyArena& Arena, const char* P, size_t Size)
+{
+    if (Size > std::numeric_limits<unsigned>::max() - 1) {
+        throw length_error(Format("TKeyStr.Assign> Key too long (%zu).",Size));
+    }
+    Release(Arena);
+
+    char* Buf = FBuf;
+    if (Size >= KEY_INLINE_SIZE) {
+        Buf = Arena.Alloc(Size+1);
+        memcpy(FBuf+4,&Buf,sizeof(Buf));
+    }
+    memcpy(Buf,P,Size);
+    Buf[Size] = 0;
+    FSize = Size;
+}
+
+inline void TKeyStr::Release(TKeyArena& Arena)
+{
+    if (!IsInline()) Arena.Free(Ptr(),FSize+1);
+    FSize = 0;
+    FBuf[0] = 0;
+}
+
+//--------------------------------------------------------------------
+// TSlab: fixed size nodes carved from SLAB_BYTES blocks
+//
+// Released nodes go to a free list and are reused by the next New().
+// Rewind() recycles every slab in bulk (they are carved again from the
+// first one) and Reset() returns them to the system. Neither runs
+// destructors: callers destroy live nodes first unless TSlab<T>::TRIVIAL
+// says there is nothing to destroy.
+//--------------------------------------------------------------------
+#if __cplusplus >= 201103L
+  #include <type_traits>
+  #define HASHLIST_TRIVIAL_DTOR(T)  std::is_trivially_destructible<T>::value
+#else
+  #define HASHLIST_TRIVIAL_DTOR(T)  __has_trivial_destructor(T)
+#endif
+
+const size_t SLAB_BYTES = 64 * 1024;
+
+template <typename T>
+class TSlab {
+    public:
+        static const bool TRIVIAL = HASHLIST_TRIVIAL_DTOR(T);
+
+        TSlab() : FSlabs(nullptr), FLast(nullptr), FCurr(nullptr), FFree(nullptr),
+                  FPos(nullptr), FEnd(nullptr), FCount(0) {}
+        ~TSlab() { Reset(); }
+#if __cplusplus >= 201103L
+        // A node built from Args, given back if its constructor throws
+        template <typename... _Args>
+        T* New(_Args&&... Args) {
+            void* P = Alloc();
+            try {
+                return new (P) T(std::forward<_Args>(Args)...);
+            } catch (...) {
+                Free(P);
+                throw;
+            }
+        }
+#else
+        T* New() { return new (Alloc()) T(); }
+#endif
+        void Delete(T* P) {
+            P->~T();
+            Free(P);
+        }
+        void Rewind();
+        void Reset();
+        size_t SlabCount() const { return FCount; }
+    private:
+        struct TBlock {
+            TBlock* Next;
+            double  Align_;     // Nodes start at a max-aligned offset
+        };
+        enum {
+            NODE_SIZE = sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*),
+            NODES_PER_SLAB = (SLAB_BYTES - sizeof(TBlock)) / NODE_SIZE > 0 ?
+                             (SLAB_BYTES - sizeof(TBlock)) / NODE_SIZE : 1
+        };
+
+        TBlock* FSlabs;     // Single-Linked list of slabs, in allocation order
+        TBlock* FLast;      // Last of FSlabs
+        TBlock* FCurr;      // Slab carved by FPos, nullptr after Rewind()
+        void*   FFree;      // FreeList: released nodes (Single-Linked list)
+        char*   FPos;       // Next never used node of FCurr
+        char*   FEnd;
+        size_t  FCount;     // Count of slabs
+
+        void* Alloc();
+        void Free(void* P) {
+            *static_cast<void**>(P) = FFree;
+            FFree = P;
+        }
+
+        TSlab(const TSlab&);
+        TSlab& operator=(const TSlab&);
+};
+
+template <typename T>
+void* TSlab<T>::Alloc()
+{
+    void* Result = FFree;
+    if (Result != nullptr) {
+        FFree = *static_cast<void**>(Result);
+        return Result;
+    }
+
+    if (FPos == FEnd) {
+        // Next slab: a rewound one, or a new one at the end of FSlabs
+        TBlock* Block = (FCurr == nullptr ? FSlabs : FCurr->Next);
+        if (Block == nullptr) {
+            size_t Size = sizeof(TBlock) + NODES_PER_SLAB * NODE_SIZE;
+            Block = static_cast<TBlock*>(malloc(Size));
+            if (Block == nullptr) throw bad_alloc();
+            Block->Next = nullptr;
+            if (FLast == nullptr) FSlabs = Block;
+            else FLast->Next = Block;
+            FLast = Block;
+            FCount++;
+        }
+        FCurr = Block;
+        FPos = reinterpret_cast<char*>(Block + 1);
+        FEnd = FPos + NODES_PER_SLAB * NODE_SIZE;
+    }
+    Result = FPos;
+    FPos += NODE_SIZE;
+    return Result;
+}
+
+template <typename T>
+void TSlab<T>::Rewind()
+{
+    FCurr = nullptr;
+    FFree = nullptr;
+    FPos = nullptr;
+    FEnd = nullptr;
+}
+
+template <typename T>
+void TSlab<T>::Reset()
+{
+    TBlock* Block = FSlabs;
+    while (Block != nullptr) {
+        TBlock* P = Block;
+        Block = Block->Next;
+        free(P);
+    }
+    FSlabs = nullptr;
+    FLast = nullptr;
+    FCount = 0;
+    Rewind();
+}
+
+//--------------------------------------------------------------------
+// TFrequencySketch: count-min sketch of access frequencies (TinyLFU)
+//
+// SKETCH_DEPTH rows of saturating 4-bit counters (one byte each) indexed
+// by independent remixes of the key's hash. After SKETCH_SAMPLES * width
+// increments every counter is halved, so old popularity fades out.
+//--------------------------------------------------------------------
+const int SKETCH_DEPTH      = 4;
+const int SKETCH_SAMPLES    = 10;
+const unsigned char SKETCH_MAX = 15;
+
+class TFrequencySketch {
+    public:
+        TFrequencySketch() : FTable(nullptr), FWidth(0), FShift(0), FSamples(0), FSampleSize(0) {}
+        ~TFrequencySketch() { delete[] FTable; }
+        void Resize(size_t Capacity);
+        void Increment(size_t Hash);
+        unsigned Estimate(size_t Hash) const;
+        bool Enabled() const { return FTable != nullptr; }
+    private:
+        unsigned char* FTable;  // [SKETCH_DEPTH][FWidth]
+        size_t  FWidth;         // power of 2
+        int     FShift;         // 64 - log2(FWidth)
+        size_t  FSamples;       // Increments since the last aging
+        size_t  FSampleSize;    // Age when FSamples reaches it
+
+        size_t Index(size_t Hash, int Row) const {
+            static const unsigned long long Seeds[SKETCH_DEPTH] = {
+                0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+                0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL
+            };
+            unsigned long long H = ((unsigned long long)Hash + Row) * Seeds[Row];
+            return Row * FWidth + (size_t)((H ^ (H >> 29)) >> FShift);
+        }
+
+        TFrequencySketch(const TFrequencySketch&);
+        TFrequencySketch& operator=(const TFrequencySketch&);
+};
+
+inline void TFrequencySketch::Resize(size_t Capacity)
+{
+    delete[] FTable;
+    FTable = nullptr;
+    if (Capacity == 0) return;
+
+    FWidth = 64;
+    FShift = 64 - 6;
+    while (FWidth < Capacity) {
+        FWidth <<= 1;
+        FShift--;
+    }
+    FTable = new unsigned char[SKETCH_DEPTH * FWidth];
+    memset(FTable,0,SKETCH_DEPTH * FWidth);
+    FSamples = 0;
+    FSampleSize = SKETCH_SAMPLES * FWidth;
+}
+
+inline void TFrequencySketch::Increment(size_t Hash)
+{
+    for (int Row = 0; Row < SKETCH_DEPTH; Row++) {
+        unsigned char& Counter = FTable[Index(Hash,Row)];
+        if (Counter < SKETCH_MAX) Counter++;
+    }
+
+    if (++FSamples >= FSampleSize) {
+        // Aging: halve every counter
+        for (size_t i = 0; i < SKETCH_DEPTH * FWidth; i++) {
+            FTable[i] >>= 1;
+        }
+        FSamples /= 2;
+    }
+}
+
+inline unsigned TFrequencySketch::Estimate(size_t Hash) const
+{
+    unsigned Result = SKETCH_MAX;
+    for (int Row = 0; Row < SKETCH_DEPTH; Row++) {
+        unsigned Counter = FTable[Index(Hash,Row)];
+        if (Counter < Result) Result = Counter;
+    }
+    return Result;
+}
+
+#if __cplusplus >= 201103L
+// Tag of the TBucket constructor which builds Value in place
+struct TEmplace {};
+#endif
+
 template <typename T>
 struct TBucket {
     TBucket*    Link;       // Single-Linked List
-    TBucket*    Next;       // Double-Linked List: Next^
-    TBucket*    Prev;       // Double-Linked List: Prev^
-    size_t      HitCount;
-    string      Key;
+    size_t      Slot;       // Index in Entries[] (insertion order)
+    size_t      Hash;       // HashKey(Key): compared before Key, reused by Resize()
+    unsigned    HitCount;   // saturated, 8 bytes with the next 4 (Key.FSize, or Expires)
+#if defined(HASHLIST_TTL)
+    unsigned    Expires;    // Clock() it expires at, 0 for never
+#endif
+    TKeyStr     Key;
     T           Value;
+#if __cplusplus >= 201103L
+    TBucket() = default;    // TSlab::New(): zeroed, as without constructors
+    template <typename... _Args>
+    explicit TBucket(TEmplace, _Args&&... Args) : Value(std::forward<_Args>(Args)...) {}
+#endif
     void SetValue(const T& V) { Value = V; }
+#if __cplusplus >= 201103L
+    void SetValue(T&& V) { Value = std::move(V); }
+#endif
     void ClearValue() { Value = Empty_<T>(); }
 };
 
@@ -112,10 +559,13 @@ struct TBucket {
 template <>
 struct TBucket<char*> {
     TBucket*    Link;
-    TBucket*    Next;
-    TBucket*    Prev;
-    size_t      HitCount;
-    string      Key;
+    size_t      Slot;
+    size_t      Hash;
+    unsigned    HitCount;
+#if defined(HASHLIST_TTL)
+    unsigned    Expires;
+#endif
+    TKeyStr     Key;
     char*       Value;
     ~TBucket() { 
         if (Value != nullptr) free(Value);
@@ -133,68 +583,718 @@ struct TBucket<char*> {
 template <>
 struct TBucket<string> {
     TBucket*    Link;
-    TBucket*    Next;
-    TBucket*    Prev;
-    size_t      HitCount;
-    string      Key;
+    size_t      Slot;
+    size_t      Hash;
+    unsigned    HitCount;
+#if defined(HASHLIST_TTL)
+    unsigned    Expires;
+#endif
+    TKeyStr     Key;
     string      Value;
+#if __cplusplus >= 201103L
+    TBucket() = default;
+    template <typename... _Args>
+    explicit TBucket(TEmplace, _Args&&... Args) : Value(std::forward<_Args>(Args)...) {}
+#endif
     void SetValue(const string& V) { Value = V; }
+#if __cplusplus >= 201103L
+    void SetValue(string&& V) { Value = std::move(V); }
+#endif
     void ClearValue() { Value.clear(); }
 };
 
+//--------------------------------------------------------------------
+// Iterators of THashList: *it is a TEntryRef, it->Key and it->Value.
+// _Tp is the value type, or const _Tp for the const_ versions. Link,
+// Hash, Slot and HitCount of the TBucket stay out of reach, and Key is
+// read-only: for (auto&& Entry : X) Entry.Value = ...;
+//
+// TEntryIterator walks Entries[] in insertion order and steps over the
+// holes; TChainIterator walks one chain of FList[] by Link. Add() and
+// Delete() invalidate both, Find() with MRUFirst reorders a chain.
+//--------------------------------------------------------------------
 template <typename _Tp>
+struct TEntryRef {
+    const TKeyStr&  Key;
+    _Tp&            Value;
+
+    TEntryRef(const TKeyStr& K, _Tp& V) : Key(K), Value(V) {}
+    const TEntryRef* operator->() const { return this; }
+};
+
+template <typename _Node, typename _Tp>
+class TEntryIterator {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef TEntryRef<_Tp>  value_type;
+        typedef ptrdiff_t       difference_type;
+        typedef TEntryRef<_Tp>  pointer;        // it-> goes on to the TEntryRef
+        typedef TEntryRef<_Tp>  reference;
+
+        TEntryIterator() : FPos(nullptr), FBegin(nullptr), FEnd(nullptr) {}
+        TEntryIterator(_Node* const* Pos, _Node* const* Begin, _Node* const* End)
+            :   FPos(Pos), FBegin(Begin), FEnd(End) {
+            while (FPos != FEnd && *FPos == nullptr) FPos++;
+        }
+        operator TEntryIterator<_Node,const _Tp>() const {
+            return TEntryIterator<_Node,const _Tp>(FPos,FBegin,FEnd);
+        }
+
+        reference operator*() const { return reference((*FPos)->Key,(*FPos)->Value); }
+        pointer operator->() const { return **this; }
+        TEntryIterator& operator++() {
+            do FPos++; while (FPos != FEnd && *FPos == nullptr);
+            return *this;
+        }
+        TEntryIterator operator++(int) { TEntryIterator Result(*this); ++*this; return Result; }
+        TEntryIterator& operator--() {
+            do FPos--; while (FPos != FBegin && *FPos == nullptr);
+            return *this;
+        }
+        TEntryIterator operator--(int) { TEntryIterator Result(*this); --*this; return Result; }
+        bool operator==(const TEntryIterator& X) const { return FPos == X.FPos; }
+        bool operator!=(const TEntryIterator& X) const { return FPos != X.FPos; }
+    private:
+        _Node* const* FPos;
+        _Node* const* FBegin;
+        _Node* const* FEnd;
+};
+
+template <typename _Node, typename _Tp>
+class TChainIterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef TEntryRef<_Tp>  value_type;
+        typedef ptrdiff_t       difference_type;
+        typedef TEntryRef<_Tp>  pointer;
+        typedef TEntryRef<_Tp>  reference;
+
+        explicit TChainIterator(_Node* Curr=nullptr) : FCurr(Curr) {}
+        operator TChainIterator<_Node,const _Tp>() const {
+            return TChainIterator<_Node,const _Tp>(FCurr);
+        }
+
+        reference operator*() const { return reference(FCurr->Key,FCurr->Value); }
+        pointer operator->() const { return **this; }
+        TChainIterator& operator++() { FCurr = FCurr->Link; return *this; }
+        TChainIterator operator++(int) { TChainIterator Result(*this); ++*this; return Result; }
+        bool operator==(const TChainIterator& X) const { return FCurr == X.FCurr; }
+        bool operator!=(const TChainIterator& X) const { return FCurr != X.FCurr; }
+    private:
+        _Node*  FCurr;
+};
+
+// Hash policies of THashList: hash of Key[0..Size)
+//   size_t operator()(const char* Key, size_t Size) const;
+//   static const unsigned Id;          // tells the functions apart
+//   uint64_t Seed() const;             // Id + Seed: same hash values
+
+// TFNVHash: the original byte at a time FNV-like hash
+struct TFNVHash {
+    static const unsigned Id = 1;
+    uint64_t Seed() const { return 2166136261U; }
+    size_t operator()(const char* Key, size_t Size) const {
+        size_t Result = 2166136261U;
+        for (size_t i = 0; i < Size; i++) {
+            //Result = 31 * (Result + Key[i]);
+            //Result = 33 * (Result + Key[i]);
+            //Result = (16777619 * Result) + Key[i];
+            //Result = 16777619 * (Result ^ static_cast<size_t>(Key[i]));
+            Result = 16777619 * (Result + static_cast<size_t>(Key[i]));
+        }
+        return Result;
+    }
+};
+
+// TWyHash: wyhash (final4), 8/16 bytes at a time with 64x64->128 multiply
+struct TWyHash {
+    static const unsigned Id = 2;
+    explicit TWyHash(uint64_t Seed=0) : FSeed(Seed) {}
+    uint64_t Seed() const { return FSeed; }
+    size_t operator()(const char* Key, size_t Size) const;
+  protected:
+    uint64_t FSeed;
+  private:
+    static void Mum(uint64_t& A, uint64_t& B) {
+#if defined(__SIZEOF_INT128__)
+        __uint128_t r = A;
+        r *= B;
+        A = (uint64_t)r;
+        B = (uint64_t)(r >> 64);
+#else
+        uint64_t ha = A >> 32, hb = B >> 32, la = (uint32_t)A, lb = (uint32_t)B;
+        uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+        uint64_t t = rl + (rm0 << 32), c = t < rl, lo = t + (rm1 << 32);
+        c += lo < t;
+        A = lo;
+        B = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+    }
+    static uint64_t Mix(uint64_t A, uint64_t B) { Mum(A,B); return A ^ B; }
+    static uint64_t Read8(const unsigned char* p) { uint64_t v; memcpy(&v,p,8); return v; }
+    static uint64_t Read4(const unsigned char* p) { uint32_t v; memcpy(&v,p,4); return v; }
+    static uint64_t Read3(const unsigned char* p, size_t k) {
+        return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+    }
+};
+
+inline size_t TWyHash::operator()(const char* Key, size_t Size) const
+{
+    static const uint64_t Secret[4] = {
+        UINT64_C(0x2d358dccaa6c78a5), UINT64_C(0x8bb84b93962eacc9),
+        UINT64_C(0x4b33a62ed433d4a3), UINT64_C(0x4d5a2da51de1aa47)
+    };
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(Key);
+    uint64_t Seed = FSeed ^ Mix(FSeed ^ Secret[0], Secret[1]);
+    uint64_t a, b;
+    if (Size <= 16) {
+        if (Size >= 4) {
+            a = (Read4(p) << 32) | Read4(p + ((Size >> 3) << 2));
+            b = (Read4(p + Size - 4) << 32) | Read4(p + Size - 4 - ((Size >> 3) << 2));
+        } else if (Size > 0) {
+            a = Read3(p,Size);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = Size;
+        if (i > 48) {
+            uint64_t See1 = Seed, See2 = Seed;
+            do {
+                Seed = Mix(Read8(p) ^ Secret[1], Read8(p + 8) ^ Seed);
+                See1 = Mix(Read8(p + 16) ^ Secret[2], Read8(p + 24) ^ See1);
+                See2 = Mix(Read8(p + 32) ^ Secret[3], Read8(p + 40) ^ See2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            Seed ^= See1 ^ See2;
+        }
+        while (i > 16) {
+            Seed = Mix(Read8(p) ^ Secret[1], Read8(p + 8) ^ Seed);
+            i -= 16;
+            p += 16;
+        }
+        a = Read8(p + i - 16);
+        b = Read8(p + i - 8);
+    }
+    a ^= Secret[1];
+    b ^= Seed;
+    Mum(a,b);
+    return static_cast<size_t>(Mix(a ^ Secret[0] ^ Size, b ^ Secret[1]));
+}
+
+// TSeededWyHash: TWyHash with a seed picked per instance, so bucket
+// positions can't be predicted (hash flooding) and differ run to run
+struct TSeededWyHash : public TWyHash {
+    static const unsigned Id = 3;
+    TSeededWyHash() : TWyHash(NewSeed()) {}
+    explicit TSeededWyHash(uint64_t Seed) : TWyHash(Seed) {}
+  private:
+    static uint64_t NewSeed() {
+        static uint64_t Counter = 0;
+        uint64_t Seed = (uint64_t)time(nullptr) ^ (uint64_t)(size_t)&Counter;
+        Seed += ++Counter * UINT64_C(0x9E3779B97F4A7C15);
+        TWyHash Hash(Seed);
+        return Hash(reinterpret_cast<const char*>(&Seed),sizeof(Seed));
+    }
+};
+
+// Sizing policies of THashList: the bucket count for a requested size,
+// the next one when Add() expands, and Hash -> FList[] index
+//   static size_t Round(size_t Size);
+//   static size_t Grow(size_t Size);
+//   void Init(size_t Size);            // Size is from Round()/Grow()
+//   size_t Index(size_t Hash) const;   // 0 <= Index < Size
+
+// TPrimeSize: prime sizes of Primes[], Index() is Hash % Size by Lemire's
+// fastmod (a multiply by the precomputed reciprocal) on the hash folded
+// to 32 bits, no division on the hot path
+struct TPrimeSize {
+    static size_t Round(size_t Size) { return ToPrime(Size); }
+    static size_t Grow(size_t Size) { return ToPrime(Size+31); }
+    void Init(size_t Size) {
+        FSize = Size;
+        FMagic = UINT64_C(0xFFFFFFFFFFFFFFFF) / Size + 1;
+    }
+    size_t Index(size_t Hash) const {
+        uint32_t h = static_cast<uint32_t>(Hash ^ ((Hash >> 16) >> 16));
+#if defined(__SIZEOF_INT128__)
+        uint64_t LowBits = FMagic * h;
+        return static_cast<size_t>(((__uint128_t)LowBits * FSize) >> 64);
+#else
+        return h % FSize;
+#endif
+    }
+  private:
+    size_t   FSize;
+    uint64_t FMagic;    // ceil(2^64 / FSize)
+};
+
+// TPow2Size: power of 2 sizes, Index() by Fibonacci hashing (multiply by
+// 2^64/phi and keep the top bits) so the low bits of a weak hash still mix
+struct TPow2Size {
+    static size_t Round(size_t Size) {
+        size_t Result = 128;
+        while (Result < Size) Result <<= 1;
+        return Result;
+    }
+    static size_t Grow(size_t Size) { return Size * 2; }
+    void Init(size_t Size) {
+        FShift = 64;
+        while (Size > 1) {
+            Size >>= 1;
+            FShift--;
+        }
+    }
+    size_t Index(size_t Hash) const {
+        return static_cast<size_t>((UINT64_C(11400714819323198485) * Hash) >> FShift);
+    }
+  private:
+    int     FShift;     // 64 - log2(Size)
+};
+
+// Resize() with Threads() > 1 relinks in parallel from this many entries
+const size_t RELINK_PARALLEL_MIN = 64 * 1024;
+
+// FindMany/AddMany hash and prefetch this many keys before probing any
+const size_t PREFETCH_GROUP = 16;
+
+#if defined(__GNUC__)
+  #define HASHLIST_PREFETCH(P)  __builtin_prefetch(P)
+#else
+  #define HASHLIST_PREFETCH(P)  ((void)(P))
+#endif
+
+// How RemoveUseless() picks its victim when FCount reaches LimitCount
+enum TEvictPolicy {
+    epScan,         // Scan all entries for the smallest HitCount, O(n)
+    epClock         // CLOCK hand over Entries[]: halve HitCount until one is 0
+};
+
+// When Find0() counts a hit in Bucket->HitCount, the only thing it writes
+// on a read. HitCount ranks victims at LimitCount and MRUFirst moves.
+enum THitCounting {
+    hcAuto,         // hcAlways if LimitCount or MRUFirst, else hcNone (default)
+    hcAlways,       // every hit
+    hcSampled,      // 1 in HIT_SAMPLE_RATE hits, counted HIT_SAMPLE_RATE
+    hcNone          // never: victims by insertion order, no MRU moves
+};
+
+const unsigned HIT_SAMPLE_RATE = 16;    // power of 2
+
+// True once in HIT_SAMPLE_RATE calls at random, by a per-thread xorshift:
+// a reader samples without writing anything shared
+inline bool HitSample()
+{
+#if __cplusplus >= 201103L
+    static thread_local uint32_t State = 2463534242u;
+#else
+    static __thread uint32_t State = 2463534242u;
+#endif
+    State ^= State << 13;
+    State ^= State >> 17;
+    State ^= State << 5;
+    return (State & (HIT_SAMPLE_RATE-1)) == 0;
+}
+
+// Combine functors of THashList::Merge(): Old is the stored value
+struct TMergeAdd {
+    template <typename T> void operator()(T& Old, const T& New) const { Old += New; }
+};
+
+struct TMergeMax {
+    template <typename T> void operator()(T& Old, const T& New) const { if (Old < New) Old = New; }
+};
+
+struct TMergeReplace {
+    template <typename T> void operator()(T& Old, const T& New) const { Old = New; }
+};
+
+struct TMergeAppend {
+    template <typename T> void operator()(T& Old, const T& New) const { Old.append(New); }
+};
+
+// Counters of THashList, with -DHASHLIST_STATISTICS only: kept as it
+// goes, so Statistics() is O(1) on a live table
+#if defined(HASHLIST_STATISTICS)
+  #define HASHLIST_STAT(...)    __VA_ARGS__
+
+const int STAT_PROBE_BINS = 16;         // probe lengths 0..14, and 15 or more
+const unsigned STAT_PROBE_SAMPLE = 64;  // one probe of so many is in ProbeLength[]
+
+struct TStatistics {
+    uint64_t Hits;          // probes by key which found it: Find/Add/Delete/...
+    uint64_t Misses;
+    uint64_t Inserts;
+    uint64_t Rejects;       // not admitted at LimitCount
+    uint64_t Deletes;
+    uint64_t Evictions;     // removed at LimitCount, or by RemoveUseless()
+    uint64_t Expirations;   // removed by TTL: Expire(), or found expired
+    uint64_t Resizes;       // FList[] replaced: Resize() or a started rehash
+    uint64_t ResizeNanos;   // in Resize(), StartRehash() and RehashSome()
+    uint64_t ProbeLength[STAT_PROBE_BINS];  // sampled: buckets passed over
+
+    // Filled by Statistics()
+    size_t Count;
+    size_t HashSize;
+    size_t BucketLoad;
+
+    TStatistics() { Reset(); }
+    void Reset() { memset(this,0,sizeof(*this)); }
+    static uint64_t Nanos() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+    }
+};
+#else
+  #define HASHLIST_STAT(...)    ((void)0)
+#endif
+
+#if defined(HASHLIST_TTL)
+//--------------------------------------------------------------------
+// TTimerWheel -- hierarchical timer wheel of THashList TTL, -DHASHLIST_TTL
+//
+// Level k has TIMER_SLOTS slots of TIMER_SLOTS^k ticks each; a timer due
+// in more than TIMER_SLOTS^TIMER_LEVELS ticks waits in Far[]. A tick
+// cascades the higher slots which start there down a level, and moves
+// level 0's slot to Due[]. Advance() goes straight to the next tick that
+// has one of them not empty, by a bit per slot in Used[]: its cost is by
+// timers and levels, not by ticks. Schedule() and each cascade are O(1).
+//
+// A timer is not removed with its node, nor when the node is given another
+// Expires: it is stale, PopDue() gives it anyway and the caller checks the
+// node still expires at Expires. Stale() counts them, and once they
+// outnumber the live ones Purge() drops them all, so the wheel stays by
+// live nodes, however often they are given another TTL.
+//--------------------------------------------------------------------
+const int TIMER_BITS    = 6;
+const int TIMER_LEVELS  = 4;
+const unsigned TIMER_SLOTS = 1u << TIMER_BITS;
+
+template <typename _Node>
+class TTimerWheel {
+    public:
+        struct TTimer {
+            _Node*      Node;
+            unsigned    Expires;
+        };
+
+        explicit TTimerWheel(unsigned Now) : FNow(Now), FCount(0), FDuePos(0), FStale(0) {
+            memset(FUsed,0,sizeof(FUsed));
+        }
+        unsigned Now() const { return FNow; }
+        size_t Count() const { return FCount + FDue.size() - FDuePos; }
+        void Schedule(_Node* Node, unsigned Expires);
+        bool Advance(unsigned Now, size_t Want);
+        bool PopDue(TTimer& Timer);
+        // One more timer whose node no longer expires at its Expires
+        void Stale() {
+            if (++FStale > TIMER_SLOTS && 2 * FStale > Count()) Purge();
+        }
+        static bool Live(const TTimer& Timer) { return Timer.Node->Expires == Timer.Expires; }
+    private:
+        typedef std::vector<TTimer> TTimers;
+
+        unsigned FNow;          // ticks up to FNow are in Due[]
+        size_t  FCount;         // timers in Slots[] and Far[]
+        TTimers FSlots[TIMER_LEVELS][TIMER_SLOTS];
+        uint64_t FUsed[TIMER_LEVELS];   // bit n: Slots[Level][n] not empty
+        TTimers FFar;
+        TTimers FDue;           // Due[FDuePos..]: expired, for PopDue()
+        size_t  FDuePos;
+        size_t  FStale;         // timers counted by Stale() and not popped yet
+
+        void Purge();
+        static size_t Purge(TTimers& Timers, size_t First);
+        void Reschedule(TTimers& Timers);
+        void Reschedule(int Level, unsigned Slot);
+        unsigned NextTick() const;
+        // Steps from Start (mod TIMER_SLOTS) to the next bit of Used, which is not 0
+        static unsigned NextUsed(uint64_t Used, unsigned Start) {
+            uint64_t Rotated = (Used >> Start) | (Used << ((TIMER_SLOTS - Start) & (TIMER_SLOTS-1)));
+#if defined(__GNUC__)
+            return __builtin_ctzll(Rotated);
+#else
+            unsigned Steps = 0;
+            while ((Rotated & 1) == 0) { Rotated >>= 1; Steps++; }
+            return Steps;
+#endif
+        }
+};
+
+template <typename _Node>
+void TTimerWheel<_Node>::Schedule(_Node* Node, unsigned Expires)
+{
+    TTimer Timer;
+    Timer.Node = Node;
+    Timer.Expires = Expires;
+    if ((int)(Expires - FNow) <= 0) {
+        FDue.push_back(Timer);
+        return;
+    }
+
+    unsigned Delta = Expires - FNow;
+    FCount++;
+    for (int Level = 0; Level < TIMER_LEVELS; Level++) {
+        if (Delta < (1u << (TIMER_BITS * (Level+1)))) {
+            unsigned Slot = (Expires >> (TIMER_BITS * Level)) & (TIMER_SLOTS-1);
+            FSlots[Level][Slot].push_back(Timer);
+            FUsed[Level] |= UINT64_C(1) << Slot;
+            return;
+        }
+    }
+    FFar.push_back(Timer);
+}
+
+// Put Timers[] again by what is left of their time
+template <typename _Node>
+void TTimerWheel<_Node>::Reschedule(TTimers& Timers)
+{
+    if (Timers.empty()) return;
+    TTimers List;
+    List.swap(Timers);
+    FCount -= List.size();
+    for (size_t i = 0; i < List.size(); i++) Schedule(List[i].Node,List[i].Expires);
+}
+
+template <typename _Node>
+void TTimerWheel<_Node>::Reschedule(int Level, unsigned Slot)
+{
+    FUsed[Level] &= ~(UINT64_C(1) << Slot);
+    Reschedule(FSlots[Level][Slot]);
+}
+
+// First tick after Now() that moves a timer: a level 0 slot to Due[], a
+// higher slot down, or Far[] at the top level's wrap. Not for FCount == 0.
+template <typename _Node>
+unsigned TTimerWheel<_Node>::NextTick() const
+{
+    unsigned Result = FNow + (1u << (TIMER_BITS * TIMER_LEVELS));   // Far[]
+    Result &= ~((1u << (TIMER_BITS * TIMER_LEVELS)) - 1);
+    for (int Level = 0; Level < TIMER_LEVELS; Level++) {
+        if (FUsed[Level] == 0) continue;
+        // Slot n of Level is next taken at the tick whose bits above
+        // the level's are n and below are 0
+        unsigned Shift = TIMER_BITS * Level;
+        unsigned Base = (FNow >> Shift) + 1;
+        unsigned t = (Base + NextUsed(FUsed[Level],Base & (TIMER_SLOTS-1))) << Shift;
+        if ((int)(t - FNow) < (int)(Result - FNow)) Result = t;
+    }
+    return Result;
+}
+
+// Tick on to Now, stopping early once Want timers are due.
+// Return true if any timer became due.
+template <typename _Node>
+bool TTimerWheel<_Node>::Advance(unsigned Now, size_t Want)
+{
+    size_t Due = FDue.size() - FDuePos;
+    size_t Before = Due;
+    while ((int)(Now - FNow) > 0 && Due < Want) {
+        unsigned t = FCount == 0 ? Now : NextTick();
+        if ((int)(t - Now) > 0 || FCount == 0) {
+            FNow = Now;     // nothing moves on the way
+            break;
+        }
+        FNow = t;
+
+        // Higher levels first: the slots starting at t, then Far[] when
+        // the top level wraps
+        for (int Level = TIMER_LEVELS-1; Level > 0; Level--) {
+            if ((t & ((1u << (TIMER_BITS * Level)) - 1)) != 0) continue;
+            if (Level == TIMER_LEVELS-1 && (t & ((1u << (TIMER_BITS * TIMER_LEVELS)) - 1)) == 0) {
+                Reschedule(FFar);
+            }
+            Reschedule(Level,(t >> (TIMER_BITS * Level)) & (TIMER_SLOTS-1));
+        }
+
+        unsigned n = t & (TIMER_SLOTS-1);
+        TTimers& Slot = FSlots[0][n];
+        FUsed[0] &= ~(UINT64_C(1) << n);
+        FCount -= Slot.size();
+        FDue.insert(FDue.end(),Slot.begin(),Slot.end());
+        Slot.clear();
+        Due = FDue.size() - FDuePos;
+    }
+    return Due > Before;
+}
+
+template <typename _Node>
+bool TTimerWheel<_Node>::PopDue(TTimer& Timer)
+{
+    if (FDuePos == FDue.size()) {
+        FDue.clear();
+        FDuePos = 0;
+        return false;
+    }
+    Timer = FDue[FDuePos++];
+    if (FStale > 0 && !Live(Timer)) FStale--;
+    return true;
+}
+
+// Drop the stale timers of every slot, Far[] and Due[]
+template <typename _Node>
+void TTimerWheel<_Node>::Purge()
+{
+    FCount = 0;
+    for (int Level = 0; Level < TIMER_LEVELS; Level++) {
+        for (unsigned Slot = 0; Slot < TIMER_SLOTS; Slot++) {
+            size_t n = Purge(FSlots[Level][Slot],0);
+            if (n == 0) FUsed[Level] &= ~(UINT64_C(1) << Slot);
+            FCount += n;
+        }
+    }
+    FCount += Purge(FFar,0);
+    Purge(FDue,FDuePos);
+    FDuePos = 0;
+    FStale = 0;
+}
+
+// Keep the live timers of Timers[First..], and give back the memory of the
+// others. Return how many are kept.
+template <typename _Node>
+size_t TTimerWheel<_Node>::Purge(TTimers& Timers, size_t First)
+{
+    size_t n = 0;
+    for (size_t i = First; i < Timers.size(); i++) {
+        if (Live(Timers[i])) Timers[n++] = Timers[i];
+    }
+    Timers.resize(n);
+    if (Timers.capacity() > 2 * n) TTimers(Timers).swap(Timers);
+    return n;
+}
+#endif
+
+template <typename _Tp, typename _Sizer = TPrimeSize, typename _Hash = TFNVHash>
 class THashList {
     public:
         bool MRUFirst;      // Most-Recently-Used: moved to front of each HashList[]
+        TEvictPolicy EvictPolicy;   // default epScan
+        THitCounting HitCounting;   // default hcAuto
 
         THashList(size_t HashSize=0, size_t LimitCount=0);
         THashList(const THashList& Source);
         ~THashList();
-        void Assign(THashList& Source);
+        void Assign(const THashList& Source);
         void Clear() { ReleaseList(false); }
         void RemoveUseless();
         void GetStatistics(double& density, double& AvgDeeps, int& MaxDeeps) const;
-        bool Add(const string& Key, const _Tp& Value);
-        bool Delete(const string& Key);
-        bool Delete(int Index) { return Delete(GetBucket(Index)->Key); }
-        bool Find(const string& Key) const;
-        bool Find(const string& Key, _Tp& Value) const;
-        int IndexOf(const string& Key) const;
+        bool Add(const TKeyRef& Key, const _Tp& Value);
+#if __cplusplus >= 201103L
+        bool Add(const TKeyRef& Key, _Tp&& Value);
+        template <typename... _Args>
+        bool Emplace(const TKeyRef& Key, _Args&&... Args);
+#endif
+        bool Delete(const TKeyRef& Key);
+        bool Delete(int Index) {
+            RemoveBucket(GetBucket(Index));
+            HASHLIST_STAT(FStats.Deletes++);
+            return true;
+        }
+        bool Find(const TKeyRef& Key) const;
+        bool Find(const TKeyRef& Key, _Tp& Value) const;
+        int IndexOf(const TKeyRef& Key) const;
+        _Tp* FindOrAdd(const TKeyRef& Key, bool& Inserted);
+        template <typename _Fn>
+        bool Merge(const TKeyRef& Key, const _Tp& Value, _Fn Combine);
+        bool Increment(const TKeyRef& Key, const _Tp& Delta=1) { return Merge(Key,Delta,TMergeAdd()); }
+        template <typename _Key>
+        size_t FindMany(const _Key* Keys, size_t Count, _Tp* Values=nullptr, bool* Found=nullptr) const;
+        template <typename _Key>
+        size_t AddMany(const _Key* Keys, const _Tp* Values, size_t Count, bool* Added=nullptr);
         bool Resize(size_t HashSize);
-        const string Keys(int Index) const { return GetBucket(Index)->Key; }
-        const _Tp Values(int Index) const { return GetBucket(Index)->Value; }
+        const TKeyStr& Keys(int Index) const { return GetBucket(Index)->Key; }
+        const _Tp& Values(int Index) const { return GetBucket(Index)->Value; }
         size_t Count() const { return FCount; }
         size_t LimitCount() const { return FLimitCount; }
+        bool Admission() const { return FSketch.Enabled(); }
+        void Admission(bool Enable);
+        size_t RehashStep() const { return FRehashStep; }
+        void RehashStep(size_t Chains);
+        size_t Threads() const { return FThreads; }
+        void Threads(size_t Count) { FThreads = Count; }
         size_t HashSize() const { return FHashSize; }
-        
+#if defined(HASHLIST_TTL)
+        // TTL in ticks of Clock(), whatever unit Tick() is given: a key
+        // is gone once Clock() reaches Clock()+TTL at Add/SetTTL. Find(),
+        // IndexOf() and FindMany() miss it but leave it, so a const member
+        // never changes Count(), indices or iterators; it is removed by
+        // Expire() or by a non-const member given its Key. Till then it
+        // stays in Count(), Keys(i) and begin()..end(). Tick() never goes
+        // back, nor on by 2^31 ticks or more at once.
+        bool Add(const TKeyRef& Key, const _Tp& Value, unsigned TTL);
+        bool SetTTL(const TKeyRef& Key, unsigned TTL);
+        unsigned Clock() const { return FClock; }
+        void Tick(unsigned Now) { FClock = Now; }
+        size_t Expire(size_t Budget=std::numeric_limits<size_t>::max());
+#endif
+#if defined(HASHLIST_STATISTICS)
+        TStatistics Statistics() const;
+        void ResetStatistics() { FStats.Reset(); }
+#endif
+
+        // Entries in insertion order: for (auto&& Entry : X) ...
+        typedef TEntryIterator< TBucket<_Tp>,_Tp >          iterator;
+        typedef TEntryIterator< TBucket<_Tp>,const _Tp >    const_iterator;
+        typedef TChainIterator< TBucket<_Tp>,_Tp >          local_iterator;
+        typedef TChainIterator< TBucket<_Tp>,const _Tp >    const_local_iterator;
+        iterator begin() { return iterator(FEntries,FEntries,FEntries+FEntryCount); }
+        iterator end() { return iterator(FEntries+FEntryCount,FEntries,FEntries+FEntryCount); }
+        const_iterator begin() const { return const_iterator(FEntries,FEntries,FEntries+FEntryCount); }
+        const_iterator end() const { return const_iterator(FEntries+FEntryCount,FEntries,FEntries+FEntryCount); }
+        // Chain n of FList[], 0 <= n < bucket_count(); a pending
+        // incremental rehash is finished first
+        local_iterator begin(size_t n) { RehashAll_(); return local_iterator(FList[n]); }
+        local_iterator end(size_t) { return local_iterator(); }
+        const_local_iterator begin(size_t n) const { RehashAll_(); return const_local_iterator(FList[n]); }
+        const_local_iterator end(size_t) const { return const_local_iterator(); }
+        size_t bucket(const TKeyRef& Key) const { RehashAll_(); return FSizer.Index(HashKey(Key)); }
+
         // c++11 compatiable
         THashList& operator=(const THashList& Source);
-        _Tp& operator[](const string& Key);
+        _Tp& operator[](const TKeyRef& Key);
         void clear() { Clear(); }
         bool empty() const { return size() == 0; }
         bool rehash(size_t HashSize) { return Resize(HashSize); }
         size_t bucket_count() const { return FHashSize; }
         size_t size() const { return FCount; }
+        const _Hash& hash_function() const { return FHash; }
         double load_factor() const;
         double max_load_factor() const { return FMaxLoadFactor; }
         void max_load_factor(double factor, double avgDeeps=0, int maxDeeps=0);
     protected:
-        virtual size_t HashKey(const string& Key) const;
+        size_t HashKey(const char* Key, size_t Size) const { return FHash(Key,Size); }
+        size_t HashKey(const TKeyRef& Key) const { return HashKey(Key.Data,Key.Size); }
     private:
         typedef TBucket<_Tp>*   PBucket;
         typedef PBucket*        ZBucket;
 
         ZBucket FList;          // HashList: PBucket[] (array of Single-Linked list)
-        PBucket FFree;          // FreeList: TBucket List (Single-Linked list)
-        PBucket FActive;        // ActiveList: TBucket Double-Linked list (Prev/Next)
+        TSlab< TBucket<_Tp> > FSlab;    // Storage of TBucket, with its FreeList
+        TKeyArena FKeys;        // Storage of TBucket.Key longer than KEY_INLINE_SIZE
         size_t  FHashSize;      // length of HashList[]
-        size_t  FCount;         // length of ActiveList
+        _Sizer  FSizer;         // Hash -> HashList[] index
+        _Hash   FHash;          // Key -> Hash
+        size_t  FCount;         // Count of active buckets
         size_t  FLimitCount;    // when FCount > FLimitCount then RemoveUseless()
         size_t  FBucketLoad;    // Count of HashList[] <> nullptr
 
-        // Cache for IndexOf ...
-        mutable int     FLastIndex;
-        mutable PBucket FLastBucket;
+        // Entries: PBucket[] in insertion order (compact dict layout).
+        // Delete() leaves a hole (nullptr), counted in the Fenwick tree
+        // FHoles[] so Index <-> Slot stays O(log n) until Compact() squeezes
+        // the holes out: when Entries[] grows or holes outnumber entries.
+        ZBucket FEntries;
+        size_t  FEntryCount;    // used length of Entries[]: FCount + holes
+        size_t  FEntryCapacity; // allocated length of Entries[]
+        size_t  FFirstHole;     // Entries[0..FFirstHole) has no hole: Slot == Index
+        unsigned* FHoles;       // Fenwick tree [1..FEntryCapacity], nullptr if no hole yet
+        size_t  FHand;          // epClock: next slot of Entries[] to look at
+
+        // TinyLFU admission: Add() at LimitCount only evicts a victim which
+        // is estimated less frequent than the new key
+        mutable TFrequencySketch FSketch;
 
         // Resize/rehash hints
         double  FMaxLoadFactor; // 0 ~ 1: zero means no auto-resize
@@ -203,94 +1303,107 @@ class THashList {
         int     FMaxDeeps;      // used by !Find0() to set FOverMaxDeeps
         mutable bool FOverMaxDeeps; // set by !Find0() and used by Add()
 
+        // Incremental rehash: instead of Resize() inside Add(), FList[] is
+        // replaced at once but buckets stay on the chains of FOldList[] and
+        // move over FRehashStep chains per Add/Find/Delete. A bucket always
+        // lives on the chain ChainOf() its hash.
+        size_t  FRehashStep;    // 0: Resize() all at once (default)
+        ZBucket FOldList;       // nullptr when no rehash is pending
+        size_t  FOldHashSize;   // length of FOldList[]
+        _Sizer  FOldSizer;      // Hash -> FOldList[] index
+        size_t  FOldPos;        // FOldList[0..FOldPos) is moved to FList[]
+        size_t  FThreads;       // > 1: Resize() relinks with threads (c++11)
+#if defined(HASHLIST_TTL)
+        unsigned FClock;        // set by Tick()
+        TTimerWheel< TBucket<_Tp> >* FWheel;    // nullptr until a TTL
+        void Expires0(PBucket Bucket, unsigned TTL);
+        bool Expired0(const PBucket Bucket) const {
+            return Bucket->Expires != 0 && (int)(Bucket->Expires - FClock) <= 0;
+        }
+#endif
+#if defined(HASHLIST_STATISTICS)
+        mutable TStatistics FStats;
+        void CountProbe0(bool Hit, int Deeps) const;
+#endif
+
         void ReleaseBucket(PBucket Bucket);
+        void RemoveBucket(PBucket Bucket);
+        void Unlink0(ZBucket Head, PBucket Last, PBucket Curr);
         void ReleaseList(bool FreeNow=true);
-        bool Find0(const string& Key, size_t& nth, PBucket& Last, PBucket& Curr) const;
-        //PBucket NewBucket();
+        void Compact(size_t Capacity);
+        PBucket SelectVictim();
+        void MarkHole(size_t Slot, int Delta);
+        size_t HolesBefore(size_t Slot) const;
+        size_t SlotOf(size_t Index) const;
+        bool Find0(const TKeyRef& Key, size_t Hash, ZBucket& Head, PBucket& Last, PBucket& Curr) const;
+#if defined(HASHLIST_TTL)
+        bool Find0(const TKeyRef& Key, size_t Hash, ZBucket& Head, PBucket& Last, PBucket& Curr);
+#endif
+        PBucket Insert0(const TKeyRef& Key, size_t Hash, ZBucket Head, PBucket Last);
+        bool Admit0(size_t Hash, ZBucket Head, PBucket& Last);
+        PBucket Link0(const TKeyRef& Key, size_t Hash, ZBucket Head, PBucket Last, PBucket Bucket);
+        template <typename _Key>
+        void Prefetch0(const _Key* Keys, size_t Count, size_t* Hash) const;
+        void StartRehash(size_t HashSize);
+        void RehashSome(size_t Chains);
+        void Relink();
+#if __cplusplus >= 201103L
+        void RelinkParallel(size_t Threads);
+        template <typename _Fn>
+        static void RunThreads0(size_t Threads, _Fn Fn);
+#endif
+        void RehashStep_() const {
+            if (FOldList != nullptr) const_cast<THashList*>(this)->RehashSome(FRehashStep);
+        }
+        void RehashAll_() const {
+            if (FOldList != nullptr) const_cast<THashList*>(this)->RehashSome(FOldHashSize);
+        }
+        // Added to HitCount of a hit, 0 to leave the bucket alone
+        unsigned HitDelta0() const {
+            switch (HitCounting) {
+                case hcAlways:  return 1;
+                case hcSampled: return HitSample() ? HIT_SAMPLE_RATE : 0;
+                case hcNone:    return 0;
+                default:        return FLimitCount > 0 || MRUFirst ? 1 : 0;
+            }
+        }
+        ZBucket ChainOf(size_t Hash) const {
+            if (FOldList != nullptr) {
+                size_t xth = FOldSizer.Index(Hash);
+                if (xth >= FOldPos) return &FOldList[xth];
+            }
+            return &FList[FSizer.Index(Hash)];
+        }
+        bool InOldList(ZBucket Head) const {
+            return FOldList != nullptr &&
+                (size_t)(Head - FOldList) < FOldHashSize;
+        }
+        //void NewBucket(PBucket Curr);
         //PBucket GetBucket(const int Index) const;
 
-PBucket NewBucket()
+// Count Curr, a new node of FSlab, in Entries[]
+void NewBucket(PBucket Curr)
 {
-    // FreeList: Single-Linked list
-    PBucket Curr = FFree;
-    if (Curr == nullptr) {
-        Curr = new TBucket<_Tp>();
-    } else {
-        FFree = Curr->Link;
-    }
-
-    // ActiveList: Double-Linked list
-    if (FActive == nullptr) {
-        // First bucket
-        FActive = Curr;
-        Curr->Next = Curr;
-        Curr->Prev = Curr;
-    } else {
-        // Append Curr to last of ActiveList
-        PBucket Head = FActive;
-        PBucket Tail = Head->Prev;
-        Curr->Next = Head;
-        Curr->Prev = Tail;
-        Tail->Next = Curr;
-        Head->Prev = Curr;
+    // Entries: append Curr as the last one
+    if (FEntryCount == FEntryCapacity) {
+        // Grow, unless squeezing the holes out leaves room enough
+        size_t N = FEntryCapacity < 16 ? 16 : FEntryCapacity;
+        if (FCount >= N / 2) N *= 2;
+        Compact(N);
     }
+    if (FFirstHole == FEntryCount) FFirstHole++;
+    Curr->Slot = FEntryCount;
+    FEntries[FEntryCount++] = Curr;
     FCount++;
-
-    return Curr;
 }
 
 PBucket GetBucket(const int Index) const
 {
-    int n;
-
     if (Index < 0 || Index >= FCount) {
         throw new runtime_error(Format("THashList.GetBucket> Index out of bounds (%d).",Index));
     }
 
-    // FActive: ActiveList is Double-Linked list
-    PBucket Result;
-    if (FLastIndex >= 0) {
-        // using caches?
-        Result = FLastBucket;
-        n = Index - FLastIndex;
-        if (n == 0) return Result;
-
-        int absN = abs(n);
-        if (absN <= Index && absN <= (FCount-Index)) {
-            // Forward via caches
-            while (n > 0) {
-                Result = Result->Next;
-                n--;
-            }
-            // Backward via cache
-            while (n < 0) {
-                Result = Result->Prev;
-                n++;
-            }
-            // Caches result
-            FLastIndex = Index;
-            FLastBucket = Result;
-            return Result;
-        }
-    }
-
-    Result = FActive;
-    if (Index <= FCount / 2) {
-        // Forward from Root(FActive)
-        for (n = 1; n <= Index; n++) {
-            Result = Result->Next;
-        }
-    } else {
-        // Backward from Root(FActive)
-        for (n = FCount-Index; n >= 1; n--) {
-            Result = Result->Prev;
-        }
-    }
-
-    // Caches result
-    FLastIndex = Index;
-    FLastBucket = Result;
-    return Result;
+    return FEntries[Index < FFirstHole ? Index : SlotOf(Index)];
 }
 
 };  // class THashList {...}
@@ -299,50 +1412,78 @@ PBucket GetBucket(const int Index) const
 // THashList -- Implement
 //==========================================================
 
-const int RESERVED_BUCKET_SIZE = 64;
-
-template <typename _Tp>
-THashList<_Tp>::THashList(size_t HashSize, size_t LimitCount)
-    :   FHashSize(ToPrime(HashSize)),
+template <typename _Tp, typename _Sizer, typename _Hash>
+THashList<_Tp,_Sizer,_Hash>::THashList(size_t HashSize, size_t LimitCount)
+    :   FHashSize(_Sizer::Round(HashSize)),
         FLimitCount(LimitCount)
 {
     FList = new PBucket[FHashSize];
     memset(FList,0,FHashSize*sizeof(PBucket));
+    FSizer.Init(FHashSize);
     FBucketLoad = 0;
 
-    FFree = nullptr;
-    FActive = nullptr;
+    FEntries = nullptr;
+    FEntryCount = 0;
+    FEntryCapacity = 0;
+    FFirstHole = 0;
+    FHoles = nullptr;
+    FHand = 0;
     FCount = 0;
 
     MRUFirst = false;
+    EvictPolicy = epScan;
+    HitCounting = hcAuto;
+    FRehashStep = 0;
+    FOldList = nullptr;
+    FOldHashSize = 0;
+    FOldPos = 0;
+    FThreads = 0;
     FMaxLoadFactor = 1;
     FMaxBucketLoad = FHashSize;
     FMaxDeeps = std::numeric_limits<int>::max();
     FAvgDeeps = FMaxDeeps;
-
-    // Caches
-    FLastIndex = -1;
-    FLastBucket = nullptr;
+    FOverMaxDeeps = false;
+#if defined(HASHLIST_TTL)
+    FClock = 0;
+    FWheel = nullptr;
+#endif
 }
 
-template <typename _Tp>
-THashList<_Tp>::THashList(const THashList& Source)
+template <typename _Tp, typename _Sizer, typename _Hash>
+THashList<_Tp,_Sizer,_Hash>::THashList(const THashList& Source)
     :   FHashSize(Source.FHashSize),
+        FHash(Source.FHash),
         FLimitCount(Source.FLimitCount)
 {
     FList = new PBucket[FHashSize];
     memset(FList,0,FHashSize*sizeof(PBucket));
+    FSizer.Init(FHashSize);
     FBucketLoad = 0;
 
-    FFree = nullptr;
-    FActive = nullptr;
+    FEntries = nullptr;
+    FEntryCount = 0;
+    FEntryCapacity = 0;
+    FFirstHole = 0;
+    FHoles = nullptr;
+    FHand = 0;
     FCount = 0;
 
-    Assign(Source);     // Assign will clear caches
+    FRehashStep = 0;
+    FOldList = nullptr;
+    FOldHashSize = 0;
+    FOldPos = 0;
+    FThreads = 0;
+    FOverMaxDeeps = false;
+#if defined(HASHLIST_TTL)
+    FClock = 0;
+    FWheel = nullptr;
+#endif
+
+    Assign(Source);
 }
 
-template <typename _Tp>
-THashList<_Tp>& THashList<_Tp>::operator=(const THashList& Source)
+template <typename _Tp, typename _Sizer, typename _Hash>
+THashList<_Tp,_Sizer,_Hash>& THashList<_Tp,_Sizer,_Hash>::operator=(const THashList& Source)
 {
     if (this != &Source) {
         Clear();
@@ -353,129 +1494,247 @@ THashList<_Tp>& THashList<_Tp>::operator=(const THashList& Source)
     return *this;
 }
 
-template <typename _Tp>
-THashList<_Tp>::~THashList()
+template <typename _Tp, typename _Sizer, typename _Hash>
+THashList<_Tp,_Sizer,_Hash>::~THashList()
 {
     ReleaseList();
-
-    // Free FreeList
-    PBucket Bucket = FFree;
-    while (Bucket != nullptr) {
-        PBucket P = Bucket;
-        Bucket = Bucket->Link;
-        delete P;
-    }
-
+#if defined(HASHLIST_TTL)
+    delete FWheel;
+#endif
+    delete[] FHoles;
+    delete[] FEntries;
+    delete[] FOldList;
     delete[] FList;
 }
 
 // Return true if add success, false if Key alreay exists!
-template <typename _Tp>
-bool THashList<_Tp>::Add(const string& Key, const _Tp& Value)
+// (or, with Admission(), when Key was not admitted at LimitCount)
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool THashList<_Tp,_Sizer,_Hash>::Add(const TKeyRef& Key, const _Tp& Value)
 {
     PBucket Curr, Last;
-    size_t nth;
-    bool Result = !Find0(Key,nth,Last,Curr);
-    if (Result) {
-        if (FLimitCount > 0 && FCount >= FLimitCount) {
-            // Remove useless which hit-counter is smallest
-            RemoveUseless();
+    ZBucket Head;
+    size_t Hash = HashKey(Key);
+    RehashStep_();
+    if (Find0(Key,Hash,Head,Last,Curr)) return false;
+
+    Curr = Insert0(Key,Hash,Head,Last);
+    if (Curr == nullptr) return false;
+    Curr->SetValue(Value);
+    return true;
+}
+
+#if __cplusplus >= 201103L
+// Add(), but Value is moved into the bucket
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool THashList<_Tp,_Sizer,_Hash>::Add(const TKeyRef& Key, _Tp&& Value)
+{
+    PBucket Curr, Last;
+    ZBucket Head;
+    size_t Hash = HashKey(Key);
+    RehashStep_();
+    if (Find0(Key,Hash,Head,Last,Curr)) return false;
+
+    Curr = Insert0(Key,Hash,Head,Last);
+    if (Curr == nullptr) return false;
+    Curr->SetValue(std::move(Value));
+    return true;
+}
+
+// Add() a value built from Args, only when Key is new
+template <typename _Tp, typename _Sizer, typename _Hash>
+template <typename... _Args>
+bool THashList<_Tp,_Sizer,_Hash>::Emplace(const TKeyRef& Key, _Args&&... Args)
+{
+    PBucket Curr, Last;
+    ZBucket Head;
+    size_t Hash = HashKey(Key);
+    RehashStep_();
+    if (Find0(Key,Hash,Head,Last,Curr)) return false;
+
+    // Value is built in place in its node, which is linked only once
+    // built: a constructor which throws leaves the list as it was
+    if (!Admit0(Hash,Head,Last)) return false;
+    Curr = FSlab.New(TEmplace(),std::forward<_Args>(Args)...);
+    Link0(Key,Hash,Head,Last,Curr);
+    return true;
+}
+#endif
+
+// Link a new bucket for Key after Last, the tail of Head from !Find0().
+// Its Value is empty. Return nullptr if Key is not admitted at LimitCount.
+template <typename _Tp, typename _Sizer, typename _Hash>
+typename THashList<_Tp,_Sizer,_Hash>::PBucket THashList<_Tp,_Sizer,_Hash>::Insert0(const TKeyRef& Key, size_t Hash, ZBucket Head, PBucket Last)
+{
+    if (!Admit0(Hash,Head,Last)) return nullptr;
+    return Link0(Key,Hash,Head,Last,FSlab.New());
+}
+
+// Room for one more bucket at LimitCount: evict a victim, or return false
+// if the key of Hash is not admitted. Last is the tail of Head again.
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool THashList<_Tp,_Sizer,_Hash>::Admit0(size_t Hash, ZBucket Head, PBucket& Last)
+{
+    if (FLimitCount > 0 && FCount >= FLimitCount) {
+        // Remove useless which hit-counter is smallest
+        PBucket Victim = SelectVictim();
+        if (FSketch.Enabled() && Victim != nullptr &&
+            FSketch.Estimate(Hash) <= FSketch.Estimate(Victim->Hash)) {
+            // Not admitted: the victim is used at least as often, and
+            // stays the next one the CLOCK hand looks at
+            if (EvictPolicy == epClock) FHand = Victim->Slot;
+            HASHLIST_STAT(FStats.Rejects++);
+            return false;
+        }
+        if (Victim != nullptr) {
+            RemoveBucket(Victim);
+            HASHLIST_STAT(FStats.Evictions++);
         }
 
-        PBucket Bucket = NewBucket();
-        if (Last == nullptr) {
-            // First bucket for FList[nth]
-            FList[nth] = Bucket;
-            FBucketLoad++;
-            Bucket->Link = nullptr;
-        } else {
-            // Create Single-Linked list
-            Bucket->Link = Curr;    // Curr == NULL
-            Last->Link = Bucket;
+        // It may have been Last: find the tail of the chain again
+        Last = nullptr;
+        for (PBucket Bucket = *Head; Bucket != nullptr; Bucket = Bucket->Link) {
+            Last = Bucket;
         }
+    }
+    return true;
+}
+
+// Link Bucket, a new node of FSlab, for Key after Last
+template <typename _Tp, typename _Sizer, typename _Hash>
+typename THashList<_Tp,_Sizer,_Hash>::PBucket THashList<_Tp,_Sizer,_Hash>::Link0(const TKeyRef& Key, size_t Hash, ZBucket Head, PBucket Last, PBucket Bucket)
+{
+    try {
+        Bucket->Key.Assign(FKeys,Key.Data,Key.Size);
+        NewBucket(Bucket);
+    } catch (...) {
+        // Not counted nor linked: only the node to give back
+        Bucket->Key.Release(FKeys);
+        FSlab.Delete(Bucket);
+        throw;
+    }
+    Bucket->Link = nullptr;
+    if (Last == nullptr) {
+        // First bucket for FList[nth]
+        *Head = Bucket;
+        if (!InOldList(Head)) FBucketLoad++;
+    } else {
+        // Create Single-Linked list
+        Last->Link = Bucket;
+    }
 
-        Bucket->Key = Key;
-        Bucket->SetValue(Value);
-        Bucket->HitCount = 0;
+    Bucket->Hash = Hash;
+    Bucket->HitCount = 0;
+#if defined(HASHLIST_TTL)
+    Bucket->Expires = 0;
+#endif
+    HASHLIST_STAT(FStats.Inserts++);
 
-        // Check resize hints
-        if (FMaxBucketLoad > 0 && (FOverMaxDeeps ||
-            FBucketLoad >= FMaxBucketLoad || FCount > FBucketLoad*FAvgDeeps)) {
-            Resize(FHashSize+31);   // a number >= 1 to force expanding hash size
+    // Check resize hints (FBucketLoad is partial until a rehash is done)
+    if (FMaxBucketLoad > 0 && FOldList == nullptr && (FOverMaxDeeps ||
+        FBucketLoad >= FMaxBucketLoad || FCount > FBucketLoad*FAvgDeeps)) {
+        if (FRehashStep > 0) {
+            StartRehash(_Sizer::Grow(FHashSize));
+        } else {
+            Resize(_Sizer::Grow(FHashSize));
         }
     }
 
-    return Result;
+    return Bucket;
 }
 
-template <typename _Tp>
-void THashList<_Tp>::Assign(THashList& Source)
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::Assign(const THashList& Source)
 {
     MRUFirst = Source.MRUFirst;
+    EvictPolicy = Source.EvictPolicy;
+    HitCounting = Source.HitCounting;
+    FRehashStep = Source.FRehashStep;
+    FThreads = Source.FThreads;
+    Admission(Source.Admission());
     FMaxLoadFactor = Source.FMaxLoadFactor;
     FMaxBucketLoad = (int)(FHashSize * FMaxLoadFactor);
     FAvgDeeps = Source.FAvgDeeps;
     FMaxDeeps = Source.FMaxDeeps;
 
     Clear();
-    PBucket Bucket = Source.FActive;
-    for (int Index=Source.Count(); --Index >= 0;) {
+#if defined(HASHLIST_TTL)
+    FClock = Source.FClock;
+#endif
+    for (size_t i = 0; i < Source.FEntryCount; i++) {
+        PBucket Bucket = Source.FEntries[i];
+        if (Bucket == nullptr) continue;
+#if defined(HASHLIST_TTL)
+        if (Source.Expired0(Bucket)) continue;
+        if (Add(Bucket->Key,Bucket->Value) && Bucket->Expires != 0) {
+            // The new bucket is the last of Entries[]
+            Expires0(FEntries[FEntryCount-1],Bucket->Expires - FClock);
+        }
+#else
         Add(Bucket->Key,Bucket->Value);
-        Bucket = Bucket->Next;
+#endif
     }
 }
 
-template <typename _Tp>
-bool THashList<_Tp>::Delete(const string& Key)
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool THashList<_Tp,_Sizer,_Hash>::Delete(const TKeyRef& Key)
 {
     PBucket Curr, Last;
-    size_t nth;
-    bool Result = Find0(Key,nth,Last,Curr);
+    ZBucket Head;
+    RehashStep_();
+    bool Result = Find0(Key,HashKey(Key),Head,Last,Curr);
     if (Result) {
-        PBucket Next = Curr->Link;
-        if (Last == nullptr) {
-            // Root for FList[nth]
-            FList[nth] = Next;
-            if (Next == nullptr) FBucketLoad--;
-        } else {
-            // Remove sigle link: (Last)->(Curr)->(Next) ==> (Last)->(Next)
-            Last->Link = Next;
-        }
-
-        ReleaseBucket(Curr);
-        FLastIndex = -1;
-        FLastBucket = nullptr;
+        Unlink0(Head,Last,Curr);
+        HASHLIST_STAT(FStats.Deletes++);
     }
 
     return Result;
 }
 
-template <typename _Tp>
-bool THashList<_Tp>::Find0(const string& Key, size_t& nth, PBucket& Last, PBucket& Curr) const
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool THashList<_Tp,_Sizer,_Hash>::Find0(const TKeyRef& Key, size_t Hash, ZBucket& Head, PBucket& Last, PBucket& Curr) const
 {
     Last = nullptr;
-    nth = HashKey(Key) % FHashSize;
+    Head = ChainOf(Hash);
+    if (FSketch.Enabled()) FSketch.Increment(Hash);
 
     int Deeps = 0;
-    PBucket Bucket = FList[nth];
+    PBucket Bucket = *Head;
     if (Bucket != nullptr) {
         // HashList: FList[] Single-Linked list
         do {
-            if (Bucket->Key == Key) {
+            if (Bucket->Hash == Hash && Bucket->Key.Equals(Key.Data,Key.Size)) {
+#if defined(HASHLIST_TTL)
+                if (Expired0(Bucket)) {
+                    // A miss, the bucket is left for Expire() or the
+                    // non-const Find0() to remove
+                    Curr = Bucket;
+                    HASHLIST_STAT(CountProbe0(false,Deeps));
+                    return false;
+                }
+#endif
                 // Found -> true
                 Curr = Bucket;
-                ++(Bucket->HitCount);
+                unsigned Delta = HitDelta0();
+                if (Delta == 0) {
+                    // Nothing written: a read stays a read
+                    HASHLIST_STAT(CountProbe0(true,Deeps));
+                    return true;
+                }
+                unsigned Count = Bucket->HitCount;
+                Bucket->HitCount = Count > std::numeric_limits<unsigned>::max() - Delta ?
+                    std::numeric_limits<unsigned>::max() : Count + Delta;
 
                 if (MRUFirst && Last != nullptr && Bucket->HitCount > Last->HitCount) {
                     // Move to front of FList[nth]: -> [First] -> ... -> [Last] -> [Bucket] -> ...
                     //                                ^                               |
                     //                                |-------------------------------+
                     Last->Link = Bucket->Link;
-                    Bucket->Link = FList[nth];
-                    FList[nth] = Bucket;
+                    Bucket->Link = *Head;
+                    *Head = Bucket;
                     Last = nullptr;
                 }
-                
+                HASHLIST_STAT(CountProbe0(true,Deeps));
                 return true;
             }
             Last = Bucket;
@@ -486,44 +1745,259 @@ bool THashList<_Tp>::Find0(const string& Key, size_t& nth, PBucket& Last, PBucke
 
     // Not found -> false
     Curr = nullptr;
-    FOverMaxDeeps = (Deeps > FMaxDeeps);
+    bool Over = (Deeps > FMaxDeeps);
+    if (Over != FOverMaxDeeps) FOverMaxDeeps = Over;    // no store unless it changes
+    HASHLIST_STAT(CountProbe0(false,Deeps));
     return false;
 }
 
-template <typename _Tp>
-bool THashList<_Tp>::Find(const string& Key) const
+#if defined(HASHLIST_TTL)
+// Find0() of the members which change the list: Key found expired is
+// removed, and Last is the tail of Head again for Insert0()
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool THashList<_Tp,_Sizer,_Hash>::Find0(const TKeyRef& Key, size_t Hash, ZBucket& Head, PBucket& Last, PBucket& Curr)
+{
+    if (static_cast<const THashList*>(this)->Find0(Key,Hash,Head,Last,Curr)) return true;
+    if (Curr != nullptr) {
+        Unlink0(Head,Last,Curr);
+        HASHLIST_STAT(FStats.Expirations++);
+        Curr = nullptr;
+        Last = nullptr;
+        for (PBucket Bucket = *Head; Bucket != nullptr; Bucket = Bucket->Link) {
+            Last = Bucket;
+        }
+    }
+    return false;
+}
+#endif
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool THashList<_Tp,_Sizer,_Hash>::Find(const TKeyRef& Key) const
 {
     PBucket Curr, Last;
-    size_t nth;
-    return Find0(Key,nth,Last,Curr);
+    ZBucket Head;
+    RehashStep_();
+    return Find0(Key,HashKey(Key),Head,Last,Curr);
 }
 
-template <typename _Tp>
-bool THashList<_Tp>::Find(const string& Key, _Tp& Value) const
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool THashList<_Tp,_Sizer,_Hash>::Find(const TKeyRef& Key, _Tp& Value) const
 {
     PBucket Curr, Last;
-    size_t nth;
-    bool Result = Find0(Key,nth,Last,Curr);
+    ZBucket Head;
+    RehashStep_();
+    bool Result = Find0(Key,HashKey(Key),Head,Last,Curr);
     if (Result) {
         Value = Curr->Value;
     }
     return Result;
 }
 
-template <typename _Tp>
-_Tp& THashList<_Tp>::operator[](const string& Key)
+// Value of Key, added empty if Key is new (Inserted = true).
+// nullptr if Key is not admitted at LimitCount.
+template <typename _Tp, typename _Sizer, typename _Hash>
+_Tp* THashList<_Tp,_Sizer,_Hash>::FindOrAdd(const TKeyRef& Key, bool& Inserted)
+{
+    PBucket Curr, Last;
+    ZBucket Head;
+    size_t Hash = HashKey(Key);
+    RehashStep_();
+    Inserted = !Find0(Key,Hash,Head,Last,Curr);
+    if (Inserted) {
+        Curr = Insert0(Key,Hash,Head,Last);
+        if (Curr == nullptr) {
+            Inserted = false;
+            return nullptr;
+        }
+    }
+    return &Curr->Value;
+}
+
+// Upsert in one probe: Add(Key,Value) if Key is new, else Combine(Old,Value).
+// Return true if Key was added, like Add().
+template <typename _Tp, typename _Sizer, typename _Hash>
+template <typename _Fn>
+bool THashList<_Tp,_Sizer,_Hash>::Merge(const TKeyRef& Key, const _Tp& Value, _Fn Combine)
+{
+    PBucket Curr, Last;
+    ZBucket Head;
+    size_t Hash = HashKey(Key);
+    RehashStep_();
+    if (Find0(Key,Hash,Head,Last,Curr)) {
+        Combine(Curr->Value,Value);
+        return false;
+    }
+
+    Curr = Insert0(Key,Hash,Head,Last);
+    if (Curr == nullptr) return false;
+    Curr->SetValue(Value);
+    return true;
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+_Tp& THashList<_Tp,_Sizer,_Hash>::operator[](const TKeyRef& Key)
 {
     PBucket Curr, Last;
-    size_t nth;
-    if (Find0(Key,nth,Last,Curr)) return Curr->Value;
+    ZBucket Head;
+    size_t Hash = HashKey(Key);
+    RehashStep_();
+    if (Find0(Key,Hash,Head,Last,Curr)) return Curr->Value;
+
+    // One probe: the new bucket goes where !Find0() stopped
+    Curr = Insert0(Key,Hash,Head,Last);
+    if (Curr != nullptr) return Curr->Value;
 
+    // Not admitted at LimitCount
     static _Tp EMPTY = Empty_<_Tp>();
-    Add(Key,EMPTY);
-    return Find0(Key,nth,Last,Curr) ? Curr->Value : EMPTY;
+    EMPTY = Empty_<_Tp>();
+    return EMPTY;
 }
 
-template <typename _Tp>
-void THashList<_Tp>::max_load_factor(double factor, double avgDeeps, int maxDeeps)
+// Batched Find(): Keys[0..Count) of string, const char* or TKeyRef.
+// Found[i] and Values[i] (if not nullptr) as Find(Keys[i],Values[i]).
+// Return the number of keys found.
+template <typename _Tp, typename _Sizer, typename _Hash>
+template <typename _Key>
+size_t THashList<_Tp,_Sizer,_Hash>::FindMany(const _Key* Keys, size_t Count, _Tp* Values, bool* Found) const
+{
+    size_t Result = 0;
+    size_t Hash[PREFETCH_GROUP];
+    for (size_t First = 0; First < Count; First += PREFETCH_GROUP) {
+        size_t n = Count - First < PREFETCH_GROUP ? Count - First : PREFETCH_GROUP;
+        Prefetch0(Keys+First,n,Hash);
+        for (size_t i = 0; i < n; i++) {
+            PBucket Curr, Last;
+            ZBucket Head;
+            bool Hit = Find0(TKeyRef(Keys[First+i]),Hash[i],Head,Last,Curr);
+            if (Hit) {
+                Result++;
+                if (Values != nullptr) Values[First+i] = Curr->Value;
+            }
+            if (Found != nullptr) Found[First+i] = Hit;
+        }
+    }
+    return Result;
+}
+
+// Batched Add(): Added[i] (if not nullptr) as Add(Keys[i],Values[i]).
+// Return the number of keys added.
+template <typename _Tp, typename _Sizer, typename _Hash>
+template <typename _Key>
+size_t THashList<_Tp,_Sizer,_Hash>::AddMany(const _Key* Keys, const _Tp* Values, size_t Count, bool* Added)
+{
+    size_t Result = 0;
+    size_t Hash[PREFETCH_GROUP];
+    for (size_t First = 0; First < Count; First += PREFETCH_GROUP) {
+        size_t n = Count - First < PREFETCH_GROUP ? Count - First : PREFETCH_GROUP;
+        Prefetch0(Keys+First,n,Hash);
+        for (size_t i = 0; i < n; i++) {
+            PBucket Curr, Last;
+            ZBucket Head;
+            TKeyRef Key(Keys[First+i]);
+            bool Hit = !Find0(Key,Hash[i],Head,Last,Curr) &&
+                (Curr = Insert0(Key,Hash[i],Head,Last)) != nullptr;
+            if (Hit) {
+                Result++;
+                Curr->SetValue(Values[First+i]);
+            }
+            if (Added != nullptr) Added[First+i] = Hit;
+        }
+    }
+    return Result;
+}
+
+// Hash Keys[0..Count) and prefetch their FList[] slots, then their first
+// buckets: the cache misses of the group overlap instead of queueing up
+// one key after another. Only a hint, an Add() that resizes is harmless.
+template <typename _Tp, typename _Sizer, typename _Hash>
+template <typename _Key>
+void THashList<_Tp,_Sizer,_Hash>::Prefetch0(const _Key* Keys, size_t Count, size_t* Hash) const
+{
+    // The group's share of incremental rehash, before ChainOf()
+    if (FOldList != nullptr) const_cast<THashList*>(this)->RehashSome(FRehashStep*Count);
+
+    ZBucket Head[PREFETCH_GROUP];
+    for (size_t i = 0; i < Count; i++) {
+        TKeyRef Key(Keys[i]);
+        Hash[i] = HashKey(Key);
+        Head[i] = ChainOf(Hash[i]);
+        HASHLIST_PREFETCH(Head[i]);
+    }
+    for (size_t i = 0; i < Count; i++) {
+        PBucket Bucket = *Head[i];
+        if (Bucket != nullptr) HASHLIST_PREFETCH(Bucket);
+    }
+}
+
+// TinyLFU admission filter, for LimitCount mode only
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::Admission(bool Enable)
+{
+    FSketch.Resize(Enable ? FLimitCount : 0);
+}
+
+// Move growth of FList[] over to Add/Find/Delete, Chains at a time
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::RehashStep(size_t Chains)
+{
+    FRehashStep = Chains;
+    if (Chains == 0 && FOldList != nullptr) RehashSome(FOldHashSize);
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::StartRehash(size_t HashSize)
+{
+    HashSize = _Sizer::Round(HashSize);
+    if (HashSize == FHashSize) return;
+    if (FOldList != nullptr) RehashSome(FOldHashSize);
+    HASHLIST_STAT(uint64_t Start = TStatistics::Nanos());
+
+    FOldList = FList;
+    FOldHashSize = FHashSize;
+    FOldSizer = FSizer;
+    FOldPos = 0;
+
+    FHashSize = HashSize;
+    FList = new PBucket[FHashSize];
+    memset(FList,0,FHashSize*sizeof(PBucket));
+    FSizer.Init(FHashSize);
+    FBucketLoad = 0;
+    FMaxBucketLoad = (int)(FHashSize * FMaxLoadFactor);
+    HASHLIST_STAT(FStats.Resizes++; FStats.ResizeNanos += TStatistics::Nanos() - Start);
+}
+
+// Move the next Chains chains of FOldList[] to FList[]. A chain of FList[]
+// is kept in Entries[] order (by Slot), as Relink() leaves it, so the
+// chains end the same whatever RehashStep() is.
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::RehashSome(size_t Chains)
+{
+    HASHLIST_STAT(uint64_t Start = TStatistics::Nanos());
+    size_t Last = FOldPos + Chains;
+    if (Last > FOldHashSize || Last < FOldPos) Last = FOldHashSize;
+
+    for (; FOldPos < Last; FOldPos++) {
+        PBucket Bucket = FOldList[FOldPos];
+        while (Bucket != nullptr) {
+            PBucket Next = Bucket->Link;
+            ZBucket Link = &FList[FSizer.Index(Bucket->Hash)];
+            if (*Link == nullptr) FBucketLoad++;
+            while (*Link != nullptr && (*Link)->Slot < Bucket->Slot) Link = &(*Link)->Link;
+            Bucket->Link = *Link;
+            *Link = Bucket;
+            Bucket = Next;
+        }
+    }
+
+    if (FOldPos == FOldHashSize) {
+        delete[] FOldList;
+        FOldList = nullptr;
+    }
+    HASHLIST_STAT(FStats.ResizeNanos += TStatistics::Nanos() - Start);
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::max_load_factor(double factor, double avgDeeps, int maxDeeps)
 {
     FMaxLoadFactor = factor;
     FMaxBucketLoad = (int)(FHashSize * FMaxLoadFactor);
@@ -531,8 +2005,8 @@ void THashList<_Tp>::max_load_factor(double factor, double avgDeeps, int maxDeep
     if (maxDeeps > 0) FMaxDeeps = maxDeeps;
 }
 
-template <typename _Tp>
-double THashList<_Tp>::load_factor() const
+template <typename _Tp, typename _Sizer, typename _Hash>
+double THashList<_Tp,_Sizer,_Hash>::load_factor() const
 {
     // c++11: The average number of elements per bucket.
     //return (double)FCount / FHashSize;
@@ -541,8 +2015,8 @@ double THashList<_Tp>::load_factor() const
     return (double)FBucketLoad / FHashSize;
 }
 
-template <typename _Tp>
-void THashList<_Tp>::GetStatistics(double& density, double& AvgDeeps, int& MaxDeeps) const
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::GetStatistics(double& density, double& AvgDeeps, int& MaxDeeps) const
 {
     int nActiveBuckets = 0;
     int nMaxDeeps = 0;
@@ -558,6 +2032,12 @@ void THashList<_Tp>::GetStatistics(double& density, double& AvgDeeps, int& MaxDe
             nActiveBuckets += nDeeps;
         }
     }
+    // Chains not moved yet by an incremental rehash
+    for (size_t i = FOldPos; FOldList != nullptr && i < FOldHashSize; i++) {
+        for (PBucket Bucket = FOldList[i]; Bucket != nullptr; Bucket = Bucket->Link) {
+            nActiveBuckets++;
+        }
+    }
     assert(nActiveBuckets == FCount);
 
     if (nActiveBuckets > 0) {
@@ -571,165 +2051,509 @@ void THashList<_Tp>::GetStatistics(double& density, double& AvgDeeps, int& MaxDe
     }
 }
 
-template <typename _Tp>
-size_t THashList<_Tp>::HashKey(const string& Key) const
-{
-    int size = Key.size();
-    const char* buf = reinterpret_cast<const char*>(Key.data());
-    size_t Result = 2166136261U;
-    for (int i = 0; i < size; i++) {
-        //Result = 31 * (Result + buf[i]);
-        //Result = 33 * (Result + buf[i]);
-        //Result = (16777619 * Result) + buf[i];
-        //Result = 16777619 * (Result ^ static_cast<size_t>(buf[i]));
-        Result = 16777619 * (Result + static_cast<size_t>(buf[i]));
-    }
+#if defined(HASHLIST_STATISTICS)
+// Counters since construction or ResetStatistics(), and the sizes now
+template <typename _Tp, typename _Sizer, typename _Hash>
+TStatistics THashList<_Tp,_Sizer,_Hash>::Statistics() const
+{
+    TStatistics Result = FStats;
+    Result.Count = FCount;
+    Result.HashSize = FHashSize;
+    Result.BucketLoad = FBucketLoad;
     return Result;
 }
 
-template <typename _Tp>
-int THashList<_Tp>::IndexOf(const string& Key) const
+// Deeps: buckets of the chain passed over before the hit, or all of them
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::CountProbe0(bool Hit, int Deeps) const
+{
+    uint64_t n = Hit ? ++FStats.Hits : ++FStats.Misses;
+    if (n % STAT_PROBE_SAMPLE == 0) {
+        FStats.ProbeLength[Deeps < STAT_PROBE_BINS ? Deeps : STAT_PROBE_BINS-1]++;
+    }
+}
+#endif
+
+#if defined(HASHLIST_TTL)
+// Add() expiring TTL ticks from now, 0 for never
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool THashList<_Tp,_Sizer,_Hash>::Add(const TKeyRef& Key, const _Tp& Value, unsigned TTL)
+{
+    PBucket Curr, Last;
+    ZBucket Head;
+    size_t Hash = HashKey(Key);
+    RehashStep_();
+    if (Find0(Key,Hash,Head,Last,Curr)) return false;
+
+    Curr = Insert0(Key,Hash,Head,Last);
+    if (Curr == nullptr) return false;
+    Curr->SetValue(Value);
+    Expires0(Curr,TTL);
+    return true;
+}
+
+// Key expires TTL ticks from now, or never if TTL is 0.
+// Return false if Key is not there.
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool THashList<_Tp,_Sizer,_Hash>::SetTTL(const TKeyRef& Key, unsigned TTL)
 {
     PBucket Curr, Last;
-    size_t nth;
-    if (Find0(Key,nth,Last,Curr)) {
-        FLastBucket = Curr;
-        int Result = 0;
-        while (Curr != FActive) {
-            Curr = Curr->Prev;
+    ZBucket Head;
+    RehashStep_();
+    if (!Find0(Key,HashKey(Key),Head,Last,Curr)) return false;
+    Expires0(Curr,TTL);
+    return true;
+}
+
+// A timer for Bucket; its old one (if any) is left stale in the wheel
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::Expires0(PBucket Bucket, unsigned TTL)
+{
+    if (TTL > (unsigned)std::numeric_limits<int>::max()) {
+        throw new runtime_error(Format("THashList.Expires0> TTL too long (%u).",TTL));
+    }
+    unsigned Expires = 0;
+    if (TTL != 0) {
+        Expires = FClock + TTL;
+        if (Expires == 0) Expires = 1;      // 0 is never
+    }
+    if (Expires == Bucket->Expires) return;     // its timer stays right
+    bool Stale = (Bucket->Expires != 0);
+    Bucket->Expires = Expires;
+    if (Stale) FWheel->Stale();
+    if (Expires == 0) return;
+
+    if (FWheel == nullptr) FWheel = new TTimerWheel< TBucket<_Tp> >(FClock);
+    FWheel->Schedule(Bucket,Expires);
+}
+
+// Pop up to Budget timers due by Clock(), stale ones included, and remove
+// the buckets of the live ones: the latency of a purge is bounded by
+// Budget, not by Count(). Return how many buckets were removed.
+template <typename _Tp, typename _Sizer, typename _Hash>
+size_t THashList<_Tp,_Sizer,_Hash>::Expire(size_t Budget)
+{
+    size_t Result = 0;
+    size_t Popped = 0;
+    if (FWheel == nullptr) return 0;
+    while (Popped < Budget) {
+        typename TTimerWheel< TBucket<_Tp> >::TTimer Timer;
+        if (!FWheel->PopDue(Timer)) {
+            if (!FWheel->Advance(FClock,Budget - Popped)) break;
+            continue;
+        }
+        Popped++;
+        // Not deleted, nor given another TTL since
+        if (FWheel->Live(Timer)) {
+            Timer.Node->Expires = 0;    // no timer left to go stale
+            RemoveBucket(Timer.Node);
+            HASHLIST_STAT(FStats.Expirations++);
             Result++;
-            if (Result >= FCount) {
-                throw new runtime_error(Format("THashList.IndexOf(%s)> Internal error -- Invalid bucket for this key.",Key.c_str()));
-            }
         }
-        FLastIndex = Result;
-        return Result;
+    }
+    return Result;
+}
+#endif
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+int THashList<_Tp,_Sizer,_Hash>::IndexOf(const TKeyRef& Key) const
+{
+    PBucket Curr, Last;
+    ZBucket Head;
+    if (Find0(Key,HashKey(Key),Head,Last,Curr)) {
+        size_t Slot = Curr->Slot;
+        return Slot < FFirstHole ? Slot : Slot - HolesBefore(Slot);
     } else {
         return -1;
     }
 }
 
-template <typename _Tp>
-void THashList<_Tp>::ReleaseBucket(PBucket Bucket)
+// Unlink Bucket from its FList[] Single-Linked list, then release it
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::RemoveBucket(PBucket Bucket)
 {
-    if (Bucket == nullptr) return;
+    ZBucket Head = ChainOf(Bucket->Hash);
+    PBucket Last = nullptr;
+    PBucket Curr = *Head;
+    while (Curr != Bucket) {
+        Last = Curr;
+        Curr = Curr->Link;
+    }
+
+    Unlink0(Head,Last,Curr);
+}
 
-    PBucket Next = Bucket->Next;
-    if (Bucket == Next) {
-        // Only one
-        FActive = nullptr;
-        FCount = 0;
+// Remove Curr from its chain Head, after Last (nullptr if the first one),
+// then release it
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::Unlink0(ZBucket Head, PBucket Last, PBucket Curr)
+{
+    PBucket Next = Curr->Link;
+    if (Last == nullptr) {
+        // Root for FList[nth]
+        *Head = Next;
+        if (Next == nullptr && !InOldList(Head)) FBucketLoad--;
     } else {
-        PBucket Prev = Bucket->Prev;
-        Next->Prev = Prev;
-        Prev->Next = Next;
-        if (FActive == Bucket) FActive = Next;
-        FCount--;
-    }
-
-    // Move Bucket to FreeList or free now
-    PBucket LastFree = FFree;
-    int nCount = (LastFree == nullptr ? 0 : LastFree->HitCount);
-    if (nCount >= RESERVED_BUCKET_SIZE) {
-        // Keep only RESERVED_BUCKET_SIZE buckets in FreeList, otherwise free it now
-        delete Bucket;
+        // Remove sigle link: (Last)->(Curr)->(Next) ==> (Last)->(Next)
+        Last->Link = Next;
+    }
+    ReleaseBucket(Curr);
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::ReleaseBucket(PBucket Bucket)
+{
+    if (Bucket == nullptr) return;
+
+    // Leave a hole in Entries[], dropping the trailing ones right away
+    size_t Slot = Bucket->Slot;
+    FEntries[Slot] = nullptr;
+    if (Slot + 1 == FEntryCount) {
+        FEntryCount--;
+        while (FEntryCount > 0 && FEntries[FEntryCount-1] == nullptr) {
+            MarkHole(--FEntryCount,-1);
+        }
     } else {
-        // Insert Bucket at front of FreeList
-        Bucket->Link = LastFree;
-        Bucket->Prev = nullptr;
-        Bucket->Next = nullptr;
-        Bucket->HitCount = nCount+1;    // Counter of FreeList
-        Bucket->Key.clear();
-        Bucket->ClearValue();
+        MarkHole(Slot,+1);
+    }
+    if (Slot < FFirstHole) FFirstHole = Slot;
+    if (FFirstHole > FEntryCount) FFirstHole = FEntryCount;
+    FCount--;
+
+#if defined(HASHLIST_TTL)
+    if (Bucket->Expires != 0) {
+        Bucket->Expires = 0;    // its timer finds it gone
+        FWheel->Stale();
+    }
+#endif
+
+    // Back to the FreeList of FSlab
+    Bucket->Key.Release(FKeys);
+    FSlab.Delete(Bucket);
+
+    // Keep holes no more than live entries, so scans stay O(FCount)
+    if (FEntryCount - FCount > FCount) Compact(FEntryCapacity);
+}
+
+// Squeeze the holes out of Entries[] into a Capacity long one, keeping
+// insertion order
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::Compact(size_t Capacity)
+{
+    ZBucket XEntries = FEntries;
+    if (Capacity != FEntryCapacity) {
+        FEntries = new PBucket[Capacity];
+        if (FFirstHole > 0) memcpy(FEntries,XEntries,FFirstHole*sizeof(PBucket));
+    }
 
-        FFree = Bucket;
+    size_t n = FFirstHole;
+    size_t Hand = FHand < FEntryCount ? FHand : 0;
+    for (size_t i = FFirstHole; i < FEntryCount; i++) {
+        if (i == FHand) Hand = n;
+        PBucket Bucket = XEntries[i];
+        if (Bucket != nullptr) {
+            Bucket->Slot = n;
+            FEntries[n++] = Bucket;
+        }
     }
+    FHand = Hand < n ? Hand : 0;
+    if (XEntries != FEntries) delete[] XEntries;
+    FEntryCapacity = Capacity;
+    FEntryCount = n;
+    FFirstHole = n;
+
+    delete[] FHoles;
+    FHoles = nullptr;
 }
 
-template <typename _Tp>
-void THashList<_Tp>::ReleaseList(bool FreeNow)
+// Fenwick tree of holes: add Delta at Slot
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::MarkHole(size_t Slot, int Delta)
+{
+    if (FHoles == nullptr) {
+        FHoles = new unsigned[FEntryCapacity+1];
+        memset(FHoles,0,(FEntryCapacity+1)*sizeof(unsigned));
+    }
+    for (size_t i = Slot+1; i <= FEntryCapacity; i += i & (0-i)) {
+        FHoles[i] += Delta;
+    }
+}
+
+// Count of holes in Entries[0..Slot)
+template <typename _Tp, typename _Sizer, typename _Hash>
+size_t THashList<_Tp,_Sizer,_Hash>::HolesBefore(size_t Slot) const
 {
-    FLastIndex = -1;
-    FLastBucket = nullptr;
-    if (FActive == nullptr) return;
+    size_t Result = 0;
+    if (FHoles != nullptr) {
+        for (size_t i = Slot; i > 0; i -= i & (0-i)) {
+            Result += FHoles[i];
+        }
+    }
+    return Result;
+}
 
-    if (FreeNow) {
-        // ActiveList: Double-Linked list
-        PBucket Curr = FActive;
-        do {
-            PBucket Next = Curr->Next;
-            delete Curr;
-            Curr = Next;
-        } while (Curr != FActive);
+// Slot of the Index-th live entry: descend the Fenwick tree counting
+// live slots (slots - holes) of each node
+template <typename _Tp, typename _Sizer, typename _Hash>
+size_t THashList<_Tp,_Sizer,_Hash>::SlotOf(size_t Index) const
+{
+    if (FHoles == nullptr) return Index;
+
+    size_t Step = 1;
+    while (Step * 2 <= FEntryCapacity) Step *= 2;
+
+    size_t Pos = 0;
+    size_t Rest = Index + 1;    // live entries still to pass
+    for (; Step > 0; Step >>= 1) {
+        if (Pos + Step <= FEntryCapacity) {
+            size_t Live = Step - FHoles[Pos+Step];
+            if (Live < Rest) {
+                Pos += Step;
+                Rest -= Live;
+            }
+        }
+    }
+    return Pos;
+}
 
-        FActive = nullptr;
-        FCount = 0;
-    } else {
-        while (FActive != nullptr) {
-            ReleaseBucket(FActive);
+// Release all buckets, whole slabs at once: back to the system when
+// FreeNow, otherwise kept for the next Add()
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::ReleaseList(bool FreeNow)
+{
+    if (!TSlab< TBucket<_Tp> >::TRIVIAL) {
+        // Only for the destructors
+        for (size_t i = 0; i < FEntryCount; i++) {
+            PBucket Bucket = FEntries[i];
+            if (Bucket != nullptr) Bucket->~TBucket<_Tp>();
         }
     }
+    FEntryCount = 0;
+    FFirstHole = 0;
+    FHand = 0;
+    FCount = 0;
+    delete[] FHoles;
+    FHoles = nullptr;
+    if (FreeNow) {
+        FSlab.Reset();
+    } else {
+        FSlab.Rewind();
+    }
+    FKeys.Reset();      // Keys of the buckets above go with their blocks
+
+#if defined(HASHLIST_TTL)
+    // Its timers point into the released slabs
+    delete FWheel;
+    FWheel = nullptr;
+#endif
 
-    // Clear HashList[]
+    // Clear HashList[], no rehash left to do
     memset(FList,0,FHashSize*sizeof(PBucket));
     FBucketLoad = 0;
+    delete[] FOldList;
+    FOldList = nullptr;
 }
 
-template <typename _Tp>
-void THashList<_Tp>::RemoveUseless()
-{
-    if (FActive != nullptr) {
-        PBucket Target = FActive;
-        if (Target != Target->Next) {
-            // Find the useless -- which HitCount is smallest
-            size_t Cnt = Target->HitCount;
-            PBucket Bucket = Target->Next;
-            while (Bucket != FActive) {
-                size_t N = Bucket->HitCount;
-                Bucket->HitCount = N >> 1;  // Reduce counter by half
-                if (N < Cnt) {
-                    // So far, the smallest counter
-                    Target = Bucket;
-                    Cnt = N;
-                }
-                Bucket = Bucket->Next;
-            }
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::RemoveUseless()
+{
+    PBucket Target = SelectVictim();
+    if (Target != nullptr) {
+        RemoveBucket(Target);
+        HASHLIST_STAT(FStats.Evictions++);
+    }
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+typename THashList<_Tp,_Sizer,_Hash>::PBucket THashList<_Tp,_Sizer,_Hash>::SelectVictim()
+{
+    if (FCount == 0) return nullptr;
+
+    if (EvictPolicy == epClock) {
+        // Second chance: each pass of the hand halves HitCount, so a bucket
+        // hit k times survives about log2(k) passes. Amortized O(1).
+        for (;;) {
+            if (FHand >= FEntryCount) FHand = 0;
+            PBucket Bucket = FEntries[FHand++];
+            if (Bucket == nullptr) continue;
+            if (Bucket->HitCount == 0) return Bucket;
+            Bucket->HitCount >>= 1;
+        }
+    }
+
+    // Find the useless -- which HitCount is smallest
+    PBucket Target = nullptr;
+    size_t Cnt = 0;
+    for (size_t i = 0; i < FEntryCount; i++) {
+        PBucket Bucket = FEntries[i];
+        if (Bucket == nullptr) continue;
+        size_t N = Bucket->HitCount;
+        if (Target == nullptr) {
+            Target = Bucket;
+            Cnt = N;
+            continue;
+        }
+        Bucket->HitCount = N >> 1;  // Reduce counter by half
+        if (N < Cnt) {
+            // So far, the smallest counter
+            Target = Bucket;
+            Cnt = N;
         }
-        Delete(Target->Key);
     }
+    return Target;
 }
 
-template <typename _Tp>
-bool THashList<_Tp>::Resize(size_t HashSize)
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool THashList<_Tp,_Sizer,_Hash>::Resize(size_t HashSize)
 {
-    HashSize = ToPrime(HashSize);
-    if (HashSize == FHashSize) return false;
+    HashSize = _Sizer::Round(HashSize);
+    if (HashSize == FHashSize) {
+        if (FOldList != nullptr) RehashSome(FOldHashSize);
+        return false;
+    }
+
+    HASHLIST_STAT(uint64_t Start = TStatistics::Nanos());
 
+    // Everything is relinked from Entries[]: a pending rehash is moot
+    delete[] FOldList;
+    FOldList = nullptr;
     ZBucket XList = FList;
 
     FHashSize = HashSize;
     FList = new PBucket[FHashSize];
     memset(FList,0,FHashSize*sizeof(PBucket));
+    FSizer.Init(FHashSize);
 
     FBucketLoad = 0;
     FMaxBucketLoad = (int)(FHashSize * FMaxLoadFactor);
 
-    // Move ActiveList from XList[] to FList[]
-    if (FActive != nullptr) {
-        PBucket Bucket = FActive;
-        do {
-            Bucket = Bucket->Prev;
-            // Create Single-Linked list, insert into first position
-            size_t nth = HashKey(Bucket->Key) % FHashSize;
-            Bucket->Link = FList[nth];
-            FList[nth] = Bucket;
-            if (Bucket->Link == nullptr) FBucketLoad++;
-        } while (Bucket != FActive);
-    }
+    // Move Entries[] from XList[] to FList[]
+    Relink();
 
     if (XList != nullptr) delete[] XList;
+    HASHLIST_STAT(FStats.Resizes++; FStats.ResizeNanos += TStatistics::Nanos() - Start);
     return true;
 }
 
+// Link Entries[] into the empty FList[], backward to keep each
+// Single-Linked list in insertion order
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::Relink()
+{
+#if __cplusplus >= 201103L
+    if (FThreads > 1 && FEntryCount >= RELINK_PARALLEL_MIN) {
+        RelinkParallel(FThreads);
+        return;
+    }
+#endif
+
+    for (size_t i = FEntryCount; i-- > 0;) {
+        PBucket Bucket = FEntries[i];
+        if (Bucket == nullptr) continue;
+        // Create Single-Linked list, insert into first position
+        size_t nth = FSizer.Index(Bucket->Hash);
+        Bucket->Link = FList[nth];
+        FList[nth] = Bucket;
+        if (Bucket->Link == nullptr) FBucketLoad++;
+    }
+}
+
+#if __cplusplus >= 201103L
+// Three passes without locks, each thread on its own share:
+//  1. map its slice of Entries[] to FList[] indexes, counting how many go
+//     to each thread's chains FList[Lo..Hi)
+//  2. scatter its slice to Sorted[], grouped by destination thread; within
+//     a group slices keep their order, so a group is in Entries[] order
+//  3. link its own group, backward like Relink(): same chains, and no
+//     chain is ever written by two threads
+template <typename _Tp, typename _Sizer, typename _Hash>
+void THashList<_Tp,_Sizer,_Hash>::RelinkParallel(size_t Threads)
+{
+    struct TRelink {
+        PBucket Bucket;
+        size_t  nth;
+    };
+    size_t* Index = new size_t[FEntryCount];
+    TRelink* Sorted = new TRelink[FCount];
+    size_t* Counts = new size_t[Threads*Threads];   // [Source*Threads+Owner]
+    size_t* Loads = new size_t[Threads];
+    memset(Counts,0,Threads*Threads*sizeof(size_t));
+
+    // Owner of FList[nth] is nth * Threads / FHashSize
+    RunThreads0(Threads,[this, Index, Counts, Threads](size_t t) {
+        size_t* Count = Counts + t*Threads;
+        size_t Hi = FEntryCount * (t+1) / Threads;
+        for (size_t i = FEntryCount * t / Threads; i < Hi; i++) {
+            PBucket Bucket = FEntries[i];
+            if (Bucket == nullptr) continue;
+            Index[i] = FSizer.Index(Bucket->Hash);
+            Count[Index[i] * Threads / FHashSize]++;
+        }
+    });
+
+    // Counts[] -> where each (source, owner) pair starts in Sorted[]
+    size_t* Groups = new size_t[Threads+1];
+    size_t Pos = 0;
+    for (size_t Owner = 0; Owner < Threads; Owner++) {
+        Groups[Owner] = Pos;
+        for (size_t Source = 0; Source < Threads; Source++) {
+            size_t n = Counts[Source*Threads+Owner];
+            Counts[Source*Threads+Owner] = Pos;
+            Pos += n;
+        }
+    }
+    Groups[Threads] = Pos;
+
+    RunThreads0(Threads,[this, Index, Sorted, Counts, Threads](size_t t) {
+        size_t* Next = Counts + t*Threads;
+        size_t Hi = FEntryCount * (t+1) / Threads;
+        for (size_t i = FEntryCount * t / Threads; i < Hi; i++) {
+            PBucket Bucket = FEntries[i];
+            if (Bucket == nullptr) continue;
+            TRelink& Item = Sorted[Next[Index[i] * Threads / FHashSize]++];
+            Item.Bucket = Bucket;
+            Item.nth = Index[i];
+        }
+    });
+
+    RunThreads0(Threads,[this, Sorted, Groups, Loads](size_t t) {
+        size_t Load = 0;
+        for (size_t i = Groups[t+1]; i-- > Groups[t];) {
+            PBucket Bucket = Sorted[i].Bucket;
+            size_t nth = Sorted[i].nth;
+            Bucket->Link = FList[nth];
+            FList[nth] = Bucket;
+            if (Bucket->Link == nullptr) Load++;
+        }
+        Loads[t] = Load;
+    });
+
+    for (size_t t = 0; t < Threads; t++) FBucketLoad += Loads[t];
+    delete[] Groups;
+    delete[] Loads;
+    delete[] Counts;
+    delete[] Sorted;
+    delete[] Index;
+}
+
+// Fn(0) .. Fn(Threads-1), each on a thread of its own. One that cannot be
+// started runs here instead; all are done on return.
+template <typename _Tp, typename _Sizer, typename _Hash>
+template <typename _Fn>
+void THashList<_Tp,_Sizer,_Hash>::RunThreads0(size_t Threads, _Fn Fn)
+{
+    std::vector<std::thread> Workers;
+    Workers.reserve(Threads);
+    for (size_t t = 0; t < Threads; t++) {
+        try {
+            Workers.push_back(std::thread(Fn,t));
+        } catch (const std::system_error&) {
+            Fn(t);
+        }
+    }
+    for (size_t t = 0; t < Workers.size(); t++) Workers[t].join();
+}
+#endif
+
 }   // namespace tony
 #endif
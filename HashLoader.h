@@ -0,0 +1,218 @@
+// HashLoader.h
+// vim: set ts=4 sw=4 et:
+
+#ifndef HashLoader_H_
+#define HashLoader_H_ 1
+
+#if __cplusplus < 201103L
+  #error HashLoader.h needs c++11 (std::thread)
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <exception>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "HashList.h"
+
+namespace tony {
+
+//==========================================================
+// LoadFile -- bulk load "key value" lines into a hash list
+//
+// The file is mmap()ed and cut into one chunk per thread at newlines. Each
+// thread parses its chunk into keys (pointing into the mapping) and values
+// made by Convert(TKeyRef Value); then the list is grown once to hold all
+// of them and they are added in file order, so the first of duplicated
+// keys wins as with Add(). Lines have no length limit.
+//
+// Line format: trailing bytes <= ' ' are trimmed, the key runs up to the
+// first ' ' or ':' (leading bytes <= ' ' skipped), the value is the rest
+// after its leading blanks. Blank lines are skipped.
+//
+// Growing once leaves another HashSize/capacity than Add() line by line.
+// The same keys and values are loaded, but a list iterated in slot order
+// (TFlatHashList) lists them in another order; THashList keeps insertion
+// order either way.
+//==========================================================
+
+struct TLoadStats {
+    size_t  Lines;          // non-blank lines
+    size_t  Added;
+    size_t  Duplicated;     // or not admitted at LimitCount
+};
+
+// Key and value of one line of [p..e), p moved to the next line.
+// Return false for a blank line.
+inline bool ParseLine(const char*& p, const char* e, TKeyRef& Key, TKeyRef& Value)
+{
+    const char* Line = p;
+    const char* End = (const char*)memchr(p,'\n',e-p);
+    p = End == nullptr ? e : End + 1;
+    if (End == nullptr) End = e;
+
+    while (End > Line && (unsigned char)End[-1] <= ' ') End--;
+    if (End == Line) return false;
+
+    const char* Sep = Line;
+    while (Sep < End && *Sep != ' ' && *Sep != ':') Sep++;
+    const char* t = Line;
+    while (t < Sep && (unsigned char)*t <= ' ') t++;
+    Key = TKeyRef(t,Sep-t);
+
+    t = Sep < End ? Sep + 1 : End;
+    while (t < End && (unsigned char)*t <= ' ') t++;
+    Value = TKeyRef(t,End-t);
+    return true;
+}
+
+template <typename _Tp>
+struct TLoadChunk {
+    const char*         Begin;
+    const char*         End;
+    std::vector<TKeyRef> Keys;
+    std::vector<_Tp>    Values;
+};
+
+template <typename _Tp, typename _Fn>
+void ParseChunk(TLoadChunk<_Tp>& Chunk, _Fn Convert)
+{
+    TKeyRef Key(""), Value("");
+    for (const char* p = Chunk.Begin; p < Chunk.End; ) {
+        if (ParseLine(p,Chunk.End,Key,Value)) {
+            Chunk.Keys.push_back(Key);
+            Chunk.Values.push_back(Convert(Value));
+        }
+    }
+}
+
+// ParseChunk() of Chunks[1..] on threads and Chunks[0] here. A thread which
+// can't start has its chunk parsed here too. Every thread is joined before
+// the first exception of a chunk (Convert() or bad_alloc) is thrown again.
+template <typename _Tp, typename _Fn>
+void ParseChunks(std::vector< TLoadChunk<_Tp> >& Chunks, _Fn Convert)
+{
+    std::vector<std::exception_ptr> Errors(Chunks.size());
+    auto Parse = [&Chunks,&Errors,&Convert](size_t i) {
+        try {
+            ParseChunk(Chunks[i],Convert);
+        } catch (...) {
+            Errors[i] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> Workers;
+    Workers.reserve(Chunks.size());
+    for (size_t i = 1; i < Chunks.size(); i++) {
+        try {
+            Workers.push_back(std::thread(Parse,i));
+        } catch (const std::system_error&) {
+            Parse(i);
+        }
+    }
+    Parse(0);
+    for (size_t i = 0; i < Workers.size(); i++) Workers[i].join();
+
+    for (size_t i = 0; i < Errors.size(); i++) {
+        if (Errors[i]) std::rethrow_exception(Errors[i]);
+    }
+}
+
+// THashList takes the whole chunk with prefetching, other lists one by one
+template <typename _Tp, typename _Sizer, typename _Hash>
+size_t AddChunk(THashList<_Tp,_Sizer,_Hash>& X, const TLoadChunk<_Tp>& Chunk)
+{
+    if (Chunk.Keys.empty()) return 0;
+    return X.AddMany(&Chunk.Keys[0],&Chunk.Values[0],Chunk.Keys.size());
+}
+
+template <typename _List, typename _Tp>
+size_t AddChunk(_List& X, const TLoadChunk<_Tp>& Chunk)
+{
+    size_t Result = 0;
+    for (size_t i = 0; i < Chunk.Keys.size(); i++) {
+        if (X.Add(Chunk.Keys[i],Chunk.Values[i])) Result++;
+    }
+    return Result;
+}
+
+// LoadFile() of Text[0..Size)
+template <typename _List, typename _Fn>
+void LoadText(_List& X, const char* Text, size_t Size, _Fn Convert, TLoadStats& Stats, size_t Threads)
+{
+    typedef decltype(Convert(TKeyRef(""))) _Tp;
+    const char* TextEnd = Text + Size;
+
+    if (Threads == 0) Threads = std::thread::hardware_concurrency();
+    if (Threads == 0) Threads = 1;
+    if (Threads > Size / 4096 + 1) Threads = Size / 4096 + 1;
+
+    // Chunks end after a '\n' (or at the end of file)
+    std::vector< TLoadChunk<_Tp> > Chunks(Threads);
+    const char* p = Text;
+    for (size_t i = 0; i < Threads; i++) {
+        Chunks[i].Begin = p;
+        const char* e = i+1 == Threads ? TextEnd : Text + Size / Threads * (i+1);
+        if (e < p) e = p;
+        if (e < TextEnd) {
+            const char* nl = (const char*)memchr(e,'\n',TextEnd-e);
+            e = nl == nullptr ? TextEnd : nl + 1;
+        }
+        Chunks[i].End = p = e;
+    }
+
+    ParseChunks(Chunks,Convert);
+
+    for (size_t i = 0; i < Threads; i++) Stats.Lines += Chunks[i].Keys.size();
+
+    // Grow once for every line, instead of step by step during Add()
+    double Factor = X.max_load_factor() > 0 ? X.max_load_factor() : 1;
+    size_t HashSize = (size_t)((X.Count() + Stats.Lines) / Factor);
+    if (HashSize > X.HashSize()) X.Resize(HashSize);
+
+    for (size_t i = 0; i < Threads; i++) {
+        Stats.Added += AddChunk(X,Chunks[i]);
+    }
+    Stats.Duplicated = Stats.Lines - Stats.Added;
+}
+
+// Return false if FileName can't be read. An exception of Convert() or of
+// the list is thrown again once the file is unmapped.
+// Threads: 0 for one per hardware thread.
+template <typename _List, typename _Fn>
+bool LoadFile(_List& X, const char* FileName, _Fn Convert, TLoadStats& Stats, size_t Threads=0)
+{
+    Stats.Lines = Stats.Added = Stats.Duplicated = 0;
+    int fd = open(FileName,O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd,&st) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t Size = st.st_size;
+    if (Size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* Map = mmap(nullptr,Size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (Map == MAP_FAILED) return false;
+    madvise(Map,Size,MADV_SEQUENTIAL);
+    try {
+        LoadText(X,(const char*)Map,Size,Convert,Stats,Threads);
+    } catch (...) {
+        munmap(Map,Size);
+        throw;
+    }
+    munmap(Map,Size);
+    return true;
+}
+
+}   // namespace tony
+#endif
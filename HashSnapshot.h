@@ -0,0 +1,395 @@
+// HashSnapshot.h
+// vim: set ts=4 sw=4 et:
+
+#ifndef HashSnapshot_H_
+#define HashSnapshot_H_ 1
+
+#if __cplusplus < 201103L
+  #error HashSnapshot.h needs c++11 (std::is_trivially_copyable)
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <vector>
+#include <type_traits>
+#include "HashList.h"
+
+namespace tony {
+
+//==========================================================
+// Snapshot -- THashList saved as one binary file
+//
+// SaveSnapshot() writes the entries in insertion order with their hashes,
+// already grouped by chain of a power of 2 index (TPow2Size). The file is
+// used as it is, mmap()ed read-only by TSnapshotHashList: Find() reads it
+// in place, pages come in on demand and are shared by every process that
+// maps the same file. LoadSnapshot() rebuilds a THashList from it instead.
+//
+// Layout (native byte order, checked by Endian), every part 8 aligned:
+//   TSnapshotHeader
+//   Index:  uint64_t[HashSize+1]   Slots[Index[n]..Index[n+1]) is chain n
+//   Slots:  TSnapshotSlot[Count]   hash and entry number, by chain
+//   Keys:   uint64_t[Count+1]      offsets, then the keys, '\0' ended
+//   Values: _Tp[Count]             POD values, or
+//           uint64_t[Count+1]      offsets, then the bytes of each value
+//==========================================================
+
+const char SNAPSHOT_MAGIC[8]      = { 'H','L','S','N','A','P',0,0 };
+const uint32_t SNAPSHOT_VERSION   = 1;
+const uint32_t SNAPSHOT_ENDIAN    = 0x01020304;
+
+struct TSnapshotHeader {
+    char        Magic[8];       // SNAPSHOT_MAGIC
+    uint32_t    Version;        // SNAPSHOT_VERSION
+    uint32_t    Endian;         // SNAPSHOT_ENDIAN as written
+    uint32_t    HashId;         // _Hash::Id
+    uint32_t    ValueKind;      // TSnapshotCodec<_Tp>::Kind
+    uint64_t    HashSeed;       // _Hash::Seed()
+    uint64_t    ValueSize;      // sizeof(_Tp) of fixed size values
+    uint64_t    Count;
+    uint64_t    HashSize;       // chains of Index, a power of 2
+    uint64_t    IndexPos;       // file offsets of each part
+    uint64_t    SlotPos;
+    uint64_t    KeyPos;
+    uint64_t    ValuePos;
+    uint64_t    FileSize;
+};
+
+struct TSnapshotSlot {
+    uint64_t    Hash;
+    uint64_t    Entry;          // insertion order
+};
+
+// Value codecs: trivially copyable values are stored as they are,
+// string as bytes with an offset table
+template <typename _Tp>
+struct TSnapshotCodec {
+    static_assert(std::is_trivially_copyable<_Tp>::value,
+        "TSnapshotCodec: values must be trivially copyable, or specialize it");
+    static const uint32_t Kind = 1;
+    static const bool FIXED = true;
+    static void Append(string& Blob, const _Tp& Value) {
+        Blob.append(reinterpret_cast<const char*>(&Value),sizeof(_Tp));
+    }
+    static _Tp Decode(const char* Data, size_t) {
+        _Tp Value;
+        memcpy(&Value,Data,sizeof(_Tp));
+        return Value;
+    }
+};
+
+template <>
+struct TSnapshotCodec<string> {
+    static const uint32_t Kind = 2;
+    static const bool FIXED = false;
+    static void Append(string& Blob, const string& Value) { Blob.append(Value); }
+    static string Decode(const char* Data, size_t Size) { return string(Data,Size); }
+};
+
+// Pointers mean nothing in another process
+template <>
+struct TSnapshotCodec<char*>;
+
+// Hash function of a snapshot from its seed
+template <typename _Hash>
+inline _Hash SnapshotHash(uint64_t Seed) { return _Hash(Seed); }
+
+template <>
+inline TFNVHash SnapshotHash<TFNVHash>(uint64_t) { return TFNVHash(); }
+
+//==========================================================
+// TSnapshotHashList -- read-only THashList served from a snapshot
+//==========================================================
+
+template <typename _Tp, typename _Hash = TFNVHash>
+class TSnapshotHashList {
+    public:
+        TSnapshotHashList();
+        ~TSnapshotHashList() { Close(); }
+        // Return false if FileName can't be read; throw if it is not a
+        // snapshot of _Tp values hashed by _Hash
+        bool Open(const char* FileName);
+        void Close();
+        bool Find(const TKeyRef& Key) const { return IndexOf(Key) >= 0; }
+        bool Find(const TKeyRef& Key, _Tp& Value) const;
+        int IndexOf(const TKeyRef& Key) const;
+        const string Keys(int Index) const {
+            TKeyRef Key = KeyOf(CheckIndex(Index));
+            return string(Key.Data,Key.Size);
+        }
+        const _Tp Values(int Index) const;
+        size_t Count() const { return FHeader == nullptr ? 0 : FHeader->Count; }
+        size_t HashSize() const { return FHeader == nullptr ? 0 : FHeader->HashSize; }
+
+        // c++11 compatiable
+        bool empty() const { return size() == 0; }
+        size_t bucket_count() const { return HashSize(); }
+        size_t size() const { return Count(); }
+        const _Hash& hash_function() const { return FHash; }
+    private:
+        typedef TSnapshotCodec<_Tp> TCodec;
+
+        const char* FMap;       // whole file, nullptr when closed
+        size_t  FMapSize;
+        const TSnapshotHeader* FHeader;
+        const uint64_t* FIndex;
+        const TSnapshotSlot* FSlots;
+        const uint64_t* FKeyOffsets;
+        const char* FKeys;
+        const uint64_t* FValueOffsets;  // nullptr for fixed size values
+        const char* FValues;
+        uint64_t FKeyBytes;     // bytes at FKeys
+        uint64_t FValueBytes;   // bytes at FValues
+        TPow2Size FSizer;
+        _Hash   FHash;
+
+        size_t CheckIndex(int Index) const;
+        // Offsets from the file are checked as they are used, Open() only
+        // checks the parts fit in it
+        void Corrupt() const {
+            throw new runtime_error("TSnapshotHashList> Corrupt snapshot.");
+        }
+        TKeyRef KeyOf(size_t Entry) const {
+            uint64_t Lo = FKeyOffsets[Entry], Hi = FKeyOffsets[Entry+1];
+            if (Lo >= Hi || Hi > FKeyBytes) Corrupt();
+            return TKeyRef(FKeys + Lo,Hi - Lo - 1);
+        }
+        _Tp ValueOf(size_t Entry) const {
+            if (FValueOffsets == nullptr) {
+                return TCodec::Decode(FValues + Entry * sizeof(_Tp),sizeof(_Tp));
+            }
+            uint64_t Lo = FValueOffsets[Entry], Hi = FValueOffsets[Entry+1];
+            if (Lo > Hi || Hi > FValueBytes) Corrupt();
+            return TCodec::Decode(FValues + Lo,Hi - Lo);
+        }
+
+        TSnapshotHashList(const TSnapshotHashList&);
+        TSnapshotHashList& operator=(const TSnapshotHashList&);
+};
+
+//==========================================================
+// Snapshot -- Implement
+//==========================================================
+
+// Pad Data to a multiple of 8 bytes
+inline void SnapshotAlign(string& Data)
+{
+    Data.append((8 - Data.size() % 8) % 8,'\0');
+}
+
+// Return false if FileName can't be written
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool SaveSnapshot(const THashList<_Tp,_Sizer,_Hash>& X, const char* FileName)
+{
+    typedef TSnapshotCodec<_Tp> TCodec;
+    const _Hash& Hash = X.hash_function();
+    size_t Count = X.Count();
+
+    TSnapshotHeader Header;
+    memset(&Header,0,sizeof(Header));
+    memcpy(Header.Magic,SNAPSHOT_MAGIC,sizeof(Header.Magic));
+    Header.Version = SNAPSHOT_VERSION;
+    Header.Endian = SNAPSHOT_ENDIAN;
+    Header.HashId = _Hash::Id;
+    Header.ValueKind = TCodec::Kind;
+    Header.HashSeed = Hash.Seed();
+    Header.ValueSize = TCodec::FIXED ? sizeof(_Tp) : 0;
+    Header.Count = Count;
+    Header.HashSize = TPow2Size::Round(Count);
+    TPow2Size Sizer;
+    Sizer.Init(Header.HashSize);
+
+    // Keys and values in insertion order, slots counting sorted by chain
+    string Keys, Values;
+    std::vector<uint64_t> KeyOffsets(Count+1), ValueOffsets(Count+1);
+    std::vector<uint64_t> Index(Header.HashSize+1,0);
+    std::vector<TSnapshotSlot> Slots(Count);
+    for (size_t i = 0; i < Count; i++) {
+        const string Key = X.Keys(i);
+        KeyOffsets[i] = Keys.size();
+        Keys.append(Key.data(),Key.size()+1);
+        ValueOffsets[i] = Values.size();
+        TCodec::Append(Values,X.Values(i));
+        Slots[i].Hash = Hash(Key.data(),Key.size());
+        Slots[i].Entry = i;
+        Index[Sizer.Index(Slots[i].Hash)+1]++;
+    }
+    KeyOffsets[Count] = Keys.size();
+    ValueOffsets[Count] = Values.size();
+    for (size_t n = 0; n < Header.HashSize; n++) Index[n+1] += Index[n];
+    std::vector<TSnapshotSlot> Chains(Count);
+    std::vector<uint64_t> Next(Index.begin(),Index.end()-1);
+    for (size_t i = 0; i < Count; i++) {
+        Chains[Next[Sizer.Index(Slots[i].Hash)]++] = Slots[i];
+    }
+
+    string Data(sizeof(Header),'\0');
+    Header.IndexPos = Data.size();
+    Data.append(reinterpret_cast<const char*>(&Index[0]),Index.size()*sizeof(uint64_t));
+    Header.SlotPos = Data.size();
+    if (Count > 0) Data.append(reinterpret_cast<const char*>(&Chains[0]),Count*sizeof(TSnapshotSlot));
+    Header.KeyPos = Data.size();
+    Data.append(reinterpret_cast<const char*>(&KeyOffsets[0]),KeyOffsets.size()*sizeof(uint64_t));
+    Data.append(Keys);
+    SnapshotAlign(Data);
+    Header.ValuePos = Data.size();
+    if (!TCodec::FIXED) {
+        Data.append(reinterpret_cast<const char*>(&ValueOffsets[0]),ValueOffsets.size()*sizeof(uint64_t));
+    }
+    Data.append(Values);
+    SnapshotAlign(Data);
+    Header.FileSize = Data.size();
+    memcpy(&Data[0],&Header,sizeof(Header));
+
+    FILE* fp = fopen(FileName,"wb");
+    if (fp == nullptr) return false;
+    bool Result = fwrite(Data.data(),1,Data.size(),fp) == Data.size();
+    if (fclose(fp) != 0) Result = false;
+    return Result;
+}
+
+// Replace X's content by the snapshot, in its insertion order.
+// Return false if FileName can't be read.
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool LoadSnapshot(THashList<_Tp,_Sizer,_Hash>& X, const char* FileName)
+{
+    TSnapshotHashList<_Tp,_Hash> Snapshot;
+    if (!Snapshot.Open(FileName)) return false;
+
+    X.Clear();
+    double Factor = X.max_load_factor() > 0 ? X.max_load_factor() : 1;
+    size_t HashSize = (size_t)(Snapshot.Count() / Factor);
+    if (HashSize > X.HashSize()) X.Resize(HashSize);
+    for (size_t i = 0; i < Snapshot.Count(); i++) {
+        X.Add(Snapshot.Keys(i),Snapshot.Values(i));
+    }
+    return true;
+}
+
+template <typename _Tp, typename _Hash>
+TSnapshotHashList<_Tp,_Hash>::TSnapshotHashList()
+    :   FMap(nullptr), FMapSize(0), FHeader(nullptr)
+{
+}
+
+template <typename _Tp, typename _Hash>
+bool TSnapshotHashList<_Tp,_Hash>::Open(const char* FileName)
+{
+    Close();
+    int fd = open(FileName,O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd,&st) != 0) {
+        close(fd);
+        return false;
+    }
+    size_t Size = st.st_size;
+    if (Size < sizeof(TSnapshotHeader)) {
+        close(fd);
+        throw new runtime_error(Format("TSnapshotHashList.Open> Not a snapshot: %s.",FileName));
+    }
+    void* Map = mmap(nullptr,Size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if (Map == MAP_FAILED) return false;
+
+    const TSnapshotHeader* H = static_cast<const TSnapshotHeader*>(Map);
+    const char* Error = nullptr;
+    if (memcmp(H->Magic,SNAPSHOT_MAGIC,sizeof(H->Magic)) != 0 || H->FileSize != Size) {
+        Error = "Not a snapshot";
+    } else if (H->Version != SNAPSHOT_VERSION || H->Endian != SNAPSHOT_ENDIAN) {
+        Error = "Unsupported version or byte order";
+    } else if (H->HashId != _Hash::Id) {
+        Error = "Other hash function";
+    } else if (H->ValueKind != TCodec::Kind || (TCodec::FIXED && H->ValueSize != sizeof(_Tp))) {
+        Error = "Other value type";
+    } else if (H->HashSize == 0 || (H->HashSize & (H->HashSize - 1)) != 0 ||
+               H->HashSize >= Size / sizeof(uint64_t) || H->Count >= Size / sizeof(uint64_t) ||
+               (H->IndexPos | H->SlotPos | H->KeyPos | H->ValuePos) % 8 != 0 ||
+               H->IndexPos < sizeof(TSnapshotHeader) ||
+               H->IndexPos > Size || H->SlotPos > Size || H->KeyPos > Size || H->ValuePos > Size ||
+               H->IndexPos + (H->HashSize+1) * sizeof(uint64_t) > H->SlotPos ||
+               H->SlotPos + H->Count * sizeof(TSnapshotSlot) > H->KeyPos ||
+               H->KeyPos + (H->Count+1) * sizeof(uint64_t) > H->ValuePos ||
+               H->ValuePos + (H->Count + (TCodec::FIXED ? 0 : 1)) * (TCodec::FIXED ? sizeof(_Tp) : sizeof(uint64_t)) > Size) {
+        // Sizes first, so none of the sums above overflows
+        Error = "Corrupt snapshot";
+    }
+    if (Error != nullptr) {
+        munmap(Map,Size);
+        throw new runtime_error(Format("TSnapshotHashList.Open> %s: %s.",Error,FileName));
+    }
+
+    FMap = static_cast<const char*>(Map);
+    FMapSize = Size;
+    FHeader = H;
+    FIndex = reinterpret_cast<const uint64_t*>(FMap + H->IndexPos);
+    FSlots = reinterpret_cast<const TSnapshotSlot*>(FMap + H->SlotPos);
+    FKeyOffsets = reinterpret_cast<const uint64_t*>(FMap + H->KeyPos);
+    FKeys = reinterpret_cast<const char*>(FKeyOffsets + H->Count + 1);
+    FValueOffsets = TCodec::FIXED ? nullptr : reinterpret_cast<const uint64_t*>(FMap + H->ValuePos);
+    FValues = TCodec::FIXED ? FMap + H->ValuePos : reinterpret_cast<const char*>(FValueOffsets + H->Count + 1);
+    FKeyBytes = H->ValuePos - (H->KeyPos + (H->Count+1) * sizeof(uint64_t));
+    FValueBytes = (FMap + Size) - FValues;
+    FSizer.Init(H->HashSize);
+    FHash = SnapshotHash<_Hash>(H->HashSeed);
+    return true;
+}
+
+template <typename _Tp, typename _Hash>
+void TSnapshotHashList<_Tp,_Hash>::Close()
+{
+    if (FMap != nullptr) munmap(const_cast<char*>(FMap),FMapSize);
+    FMap = nullptr;
+    FMapSize = 0;
+    FHeader = nullptr;
+}
+
+template <typename _Tp, typename _Hash>
+int TSnapshotHashList<_Tp,_Hash>::IndexOf(const TKeyRef& Key) const
+{
+    if (FHeader == nullptr) return -1;
+    size_t Hash = FHash(Key.Data,Key.Size);
+    size_t nth = FSizer.Index(Hash);
+    uint64_t First = FIndex[nth], Last = FIndex[nth+1];
+    if (First > Last || Last > FHeader->Count) Corrupt();
+    for (uint64_t i = First; i < Last; i++) {
+        if (FSlots[i].Hash == Hash) {
+            if (FSlots[i].Entry >= FHeader->Count) Corrupt();
+            TKeyRef Found = KeyOf(FSlots[i].Entry);
+            if (Found.Size == Key.Size && memcmp(Found.Data,Key.Data,Key.Size) == 0) {
+                return (int)FSlots[i].Entry;
+            }
+        }
+    }
+    return -1;
+}
+
+template <typename _Tp, typename _Hash>
+bool TSnapshotHashList<_Tp,_Hash>::Find(const TKeyRef& Key, _Tp& Value) const
+{
+    int Index = IndexOf(Key);
+    if (Index < 0) return false;
+    Value = ValueOf(Index);
+    return true;
+}
+
+template <typename _Tp, typename _Hash>
+const _Tp TSnapshotHashList<_Tp,_Hash>::Values(int Index) const
+{
+    return ValueOf(CheckIndex(Index));
+}
+
+template <typename _Tp, typename _Hash>
+size_t TSnapshotHashList<_Tp,_Hash>::CheckIndex(int Index) const
+{
+    if (Index < 0 || (size_t)Index >= Count()) {
+        throw new runtime_error(Format("TSnapshotHashList.CheckIndex> Index out of bounds (%d).",Index));
+    }
+    return Index;
+}
+
+}   // namespace tony
+#endif
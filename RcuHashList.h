@@ -0,0 +1,465 @@
+// RcuHashList.h
+// vim: set ts=4 sw=4 et:
+
+#ifndef RcuHashList_H_
+#define RcuHashList_H_ 1
+
+#if __cplusplus < 201103L
+  #error RcuHashList.h needs c++11 (std::atomic)
+#endif
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "HashList.h"
+
+namespace tony {
+
+//==========================================================
+// TRcuHashList -- read-mostly hash list, Find() takes no lock
+//
+// Readers never write shared memory: no HitCount, no MRU relink, no
+// FOverMaxDeeps. A bucket is never changed once linked; writers (one at a
+// time, behind a mutex) publish new buckets and new FList[] arrays with an
+// atomic store, copying a bucket to update it. What they unlink is retired
+// and freed only when no reader can still be looking at it: every reader
+// announces the epoch it started in, in its own cache line of TRcuDomain.
+//==========================================================
+
+const int RCU_MAX_READERS   = 256;  // threads reading at the same time
+const size_t RCU_RECLAIM    = 64;   // retired items before Reclaim() runs
+
+struct alignas(64) TRcuSlot {
+    std::atomic<uint64_t>   Epoch;  // 0: not reading
+    std::atomic<bool>       Used;   // owned by a live thread
+};
+
+// Epoch and reader slots shared by all TRcuHashList
+class TRcuDomain {
+    public:
+        static TRcuDomain& Instance() {
+            static TRcuDomain Domain;
+            return Domain;
+        }
+
+        // Slot of this thread, claimed on first use and given back when
+        // the thread ends
+        TRcuSlot& Slot() {
+            static thread_local TThreadSlot Mine;
+            if (Mine.Slot == nullptr) Mine.Slot = Claim();
+            return *Mine.Slot;
+        }
+
+        uint64_t Epoch() const { return FEpoch.load(std::memory_order_acquire); }
+        // After an unlink: readers that see the new epoch see the unlink,
+        // return the old one
+        uint64_t Advance() { return FEpoch.fetch_add(1,std::memory_order_acq_rel); }
+
+        // Smallest epoch a reader is in, UINT64_MAX if nobody reads
+        uint64_t MinActive() const {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            uint64_t Result = UINT64_MAX;
+            int High = FHigh.load(std::memory_order_acquire);
+            for (int i = 0; i < High; i++) {
+                uint64_t e = FSlots[i].Epoch.load(std::memory_order_acquire);
+                if (e != 0 && e < Result) Result = e;
+            }
+            return Result;
+        }
+    private:
+        struct TThreadSlot {
+            TRcuSlot* Slot;
+            TThreadSlot() : Slot(nullptr) {}
+            ~TThreadSlot() {
+                if (Slot != nullptr) Slot->Used.store(false,std::memory_order_release);
+            }
+        };
+
+        TRcuSlot    FSlots[RCU_MAX_READERS];
+        std::atomic<int>        FHigh;      // FSlots[0..FHigh) ever claimed
+        std::atomic<uint64_t>   FEpoch;     // starts at 1, 0 is "not reading"
+
+        TRcuDomain() : FHigh(0), FEpoch(1) {
+            for (int i = 0; i < RCU_MAX_READERS; i++) {
+                FSlots[i].Epoch.store(0);
+                FSlots[i].Used.store(false);
+            }
+        }
+
+        TRcuSlot* Claim() {
+            for (int i = 0; i < RCU_MAX_READERS; i++) {
+                bool Free = false;
+                if (FSlots[i].Used.compare_exchange_strong(Free,true)) {
+                    int High = FHigh.load();
+                    while (High < i+1 && !FHigh.compare_exchange_weak(High,i+1)) {}
+                    return &FSlots[i];
+                }
+            }
+            throw new runtime_error(Format("TRcuDomain.Claim> More than %d reader threads.",RCU_MAX_READERS));
+        }
+};
+
+// Reader side of a Find(): announce the epoch, then the loads may start
+class TRcuReadLock {
+    public:
+        TRcuReadLock() : FSlot(TRcuDomain::Instance().Slot()) {
+            FSlot.Epoch.store(TRcuDomain::Instance().Epoch(),std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        ~TRcuReadLock() { FSlot.Epoch.store(0,std::memory_order_release); }
+    private:
+        TRcuSlot& FSlot;
+        TRcuReadLock(const TRcuReadLock&);
+        TRcuReadLock& operator=(const TRcuReadLock&);
+};
+
+template <typename _Tp>
+struct TRcuBucket {
+    std::atomic<TRcuBucket*> Link;
+    const size_t    Hash;
+    const string    Key;
+    const _Tp       Value;
+    TRcuBucket(size_t H, const TKeyRef& K, const _Tp& V, TRcuBucket* Next)
+        :   Link(Next), Hash(H), Key(K.Data,K.Size), Value(V) {}
+};
+
+template <typename _Tp, typename _Sizer = TPrimeSize, typename _Hash = TFNVHash>
+class TRcuHashList {
+    public:
+        TRcuHashList(size_t HashSize=0);
+        ~TRcuHashList();    // no reader may be left
+        void Clear();
+        void GetStatistics(double& density, double& AvgDeeps, int& MaxDeeps) const;
+        bool Add(const TKeyRef& Key, const _Tp& Value);
+        bool Update(const TKeyRef& Key, const _Tp& Value);
+        bool Delete(const TKeyRef& Key);
+        bool Find(const TKeyRef& Key) const;
+        bool Find(const TKeyRef& Key, _Tp& Value) const;
+        template <typename _Fn>
+        bool Merge(const TKeyRef& Key, const _Tp& Value, _Fn Combine);
+        bool Increment(const TKeyRef& Key, const _Tp& Delta=1) { return Merge(Key,Delta,TMergeAdd()); }
+        bool Resize(size_t HashSize);
+        void Reclaim();
+        size_t Count() const { return FCount.load(std::memory_order_relaxed); }
+        size_t HashSize() const;
+
+        // c++11 compatiable
+        void clear() { Clear(); }
+        bool empty() const { return size() == 0; }
+        bool rehash(size_t HashSize) { return Resize(HashSize); }
+        size_t bucket_count() const { return HashSize(); }
+        size_t size() const { return Count(); }
+        double max_load_factor() const { return FMaxLoadFactor; }
+        void max_load_factor(double factor) { FMaxLoadFactor = factor; }
+    private:
+        typedef TRcuBucket<_Tp>*        PBucket;
+        typedef std::atomic<PBucket>    TLink;
+
+        struct TTable {
+            size_t  Size;
+            _Sizer  Sizer;
+            TLink*  List;       // HashList: TLink[Size]
+        };
+
+        struct TRetired {
+            PBucket Bucket;
+            TTable* Table;      // with all of its buckets
+            uint64_t Epoch;     // freed when every reader is past it
+        };
+
+        std::atomic<TTable*> FTable;
+        std::atomic<size_t>  FCount;
+        double  FMaxLoadFactor; // Count > HashSize * factor: grow, 0 never
+        _Hash   FHash;
+        std::mutex FWriteLock;  // one writer at a time
+        std::vector<TRetired> FRetired;
+
+        TTable* NewTable(size_t HashSize);
+        void FreeTable(TTable* Table);
+        TLink* Find0(TTable* Table, const TKeyRef& Key, size_t Hash, PBucket& Bucket) const;
+        void Retire(PBucket Bucket, TTable* Table);
+        void Written();
+        bool Resize0(size_t HashSize);
+        void Reclaim0();
+
+        TRcuHashList(const TRcuHashList&);
+        TRcuHashList& operator=(const TRcuHashList&);
+};
+
+//==========================================================
+// TRcuHashList -- Implement
+//==========================================================
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+TRcuHashList<_Tp,_Sizer,_Hash>::TRcuHashList(size_t HashSize)
+    :   FCount(0)
+{
+    FMaxLoadFactor = 1;
+    FTable.store(NewTable(_Sizer::Round(HashSize)));
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+TRcuHashList<_Tp,_Sizer,_Hash>::~TRcuHashList()
+{
+    for (size_t i = 0; i < FRetired.size(); i++) {
+        if (FRetired[i].Bucket != nullptr) delete FRetired[i].Bucket;
+        if (FRetired[i].Table != nullptr) FreeTable(FRetired[i].Table);
+    }
+    FreeTable(FTable.load());
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+typename TRcuHashList<_Tp,_Sizer,_Hash>::TTable* TRcuHashList<_Tp,_Sizer,_Hash>::NewTable(size_t HashSize)
+{
+    TTable* Table = new TTable;
+    Table->Size = HashSize;
+    Table->Sizer.Init(HashSize);
+    Table->List = new TLink[HashSize];
+    for (size_t i = 0; i < HashSize; i++) {
+        Table->List[i].store(nullptr,std::memory_order_relaxed);
+    }
+    return Table;
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TRcuHashList<_Tp,_Sizer,_Hash>::FreeTable(TTable* Table)
+{
+    for (size_t i = 0; i < Table->Size; i++) {
+        PBucket Bucket = Table->List[i].load(std::memory_order_relaxed);
+        while (Bucket != nullptr) {
+            PBucket Next = Bucket->Link.load(std::memory_order_relaxed);
+            delete Bucket;
+            Bucket = Next;
+        }
+    }
+    delete[] Table->List;
+    delete Table;
+}
+
+// Link that points to Key's bucket, or the chain's nullptr end.
+// Bucket is what was compared: a writer may store another one into
+// Link right after, so readers must not load it again.
+template <typename _Tp, typename _Sizer, typename _Hash>
+typename TRcuHashList<_Tp,_Sizer,_Hash>::TLink* TRcuHashList<_Tp,_Sizer,_Hash>::Find0(TTable* Table, const TKeyRef& Key, size_t Hash, PBucket& Bucket) const
+{
+    TLink* Link = &Table->List[Table->Sizer.Index(Hash)];
+    for (;;) {
+        Bucket = Link->load(std::memory_order_acquire);
+        if (Bucket == nullptr || (Bucket->Hash == Hash && Key == Bucket->Key)) return Link;
+        Link = &Bucket->Link;
+    }
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+size_t TRcuHashList<_Tp,_Sizer,_Hash>::HashSize() const
+{
+    TRcuReadLock Guard;
+    return FTable.load(std::memory_order_acquire)->Size;
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool TRcuHashList<_Tp,_Sizer,_Hash>::Find(const TKeyRef& Key) const
+{
+    size_t Hash = FHash(Key.Data,Key.Size);
+    TRcuReadLock Guard;
+    TTable* Table = FTable.load(std::memory_order_acquire);
+    PBucket Bucket;
+    Find0(Table,Key,Hash,Bucket);
+    return Bucket != nullptr;
+}
+
+// Value is copied out before the reader leaves its epoch
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool TRcuHashList<_Tp,_Sizer,_Hash>::Find(const TKeyRef& Key, _Tp& Value) const
+{
+    size_t Hash = FHash(Key.Data,Key.Size);
+    TRcuReadLock Guard;
+    TTable* Table = FTable.load(std::memory_order_acquire);
+    PBucket Bucket;
+    Find0(Table,Key,Hash,Bucket);
+    if (Bucket == nullptr) return false;
+    Value = Bucket->Value;
+    return true;
+}
+
+// Return true if add success, false if Key alreay exists!
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool TRcuHashList<_Tp,_Sizer,_Hash>::Add(const TKeyRef& Key, const _Tp& Value)
+{
+    size_t Hash = FHash(Key.Data,Key.Size);
+    std::lock_guard<std::mutex> Guard(FWriteLock);
+    TTable* Table = FTable.load(std::memory_order_relaxed);
+    PBucket Bucket;
+    TLink* Link = Find0(Table,Key,Hash,Bucket);
+    if (Bucket != nullptr) return false;
+
+    // Publish at the chain's end: readers see all of it or nothing
+    Link->store(new TRcuBucket<_Tp>(Hash,Key,Value,nullptr),std::memory_order_release);
+    FCount.fetch_add(1,std::memory_order_relaxed);
+    Written();
+    return true;
+}
+
+// Add Key, or replace its bucket by a copy holding Value.
+// Return true if Key was added.
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool TRcuHashList<_Tp,_Sizer,_Hash>::Update(const TKeyRef& Key, const _Tp& Value)
+{
+    return Merge(Key,Value,TMergeReplace());
+}
+
+// Like THashList::Merge(), Combine() runs on a copy of the old value
+template <typename _Tp, typename _Sizer, typename _Hash>
+template <typename _Fn>
+bool TRcuHashList<_Tp,_Sizer,_Hash>::Merge(const TKeyRef& Key, const _Tp& Value, _Fn Combine)
+{
+    size_t Hash = FHash(Key.Data,Key.Size);
+    std::lock_guard<std::mutex> Guard(FWriteLock);
+    TTable* Table = FTable.load(std::memory_order_relaxed);
+    PBucket Old;
+    TLink* Link = Find0(Table,Key,Hash,Old);
+    if (Old == nullptr) {
+        Link->store(new TRcuBucket<_Tp>(Hash,Key,Value,nullptr),std::memory_order_release);
+        FCount.fetch_add(1,std::memory_order_relaxed);
+        Written();
+        return true;
+    }
+
+    _Tp NewValue(Old->Value);
+    Combine(NewValue,Value);
+    PBucket Next = Old->Link.load(std::memory_order_relaxed);
+    Link->store(new TRcuBucket<_Tp>(Hash,Key,NewValue,Next),std::memory_order_release);
+    Retire(Old,nullptr);
+    Written();
+    return false;
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool TRcuHashList<_Tp,_Sizer,_Hash>::Delete(const TKeyRef& Key)
+{
+    size_t Hash = FHash(Key.Data,Key.Size);
+    std::lock_guard<std::mutex> Guard(FWriteLock);
+    TTable* Table = FTable.load(std::memory_order_relaxed);
+    PBucket Bucket;
+    TLink* Link = Find0(Table,Key,Hash,Bucket);
+    if (Bucket == nullptr) return false;
+
+    // A reader on Bucket still gets to the rest of the chain from it
+    Link->store(Bucket->Link.load(std::memory_order_relaxed),std::memory_order_release);
+    FCount.fetch_sub(1,std::memory_order_relaxed);
+    Retire(Bucket,nullptr);
+    Written();
+    return true;
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool TRcuHashList<_Tp,_Sizer,_Hash>::Resize(size_t HashSize)
+{
+    std::lock_guard<std::mutex> Guard(FWriteLock);
+    bool Result = Resize0(_Sizer::Round(HashSize));
+    if (FRetired.size() >= RCU_RECLAIM) Reclaim0();
+    return Result;
+}
+
+// Readers may still walk the old chains, so every bucket is copied into
+// the new FList[] before it is published; the old ones go with the table
+template <typename _Tp, typename _Sizer, typename _Hash>
+bool TRcuHashList<_Tp,_Sizer,_Hash>::Resize0(size_t HashSize)
+{
+    TTable* Old = FTable.load(std::memory_order_relaxed);
+    if (HashSize == Old->Size) return false;
+
+    TTable* Table = NewTable(HashSize);
+    for (size_t i = 0; i < Old->Size; i++) {
+        for (PBucket Bucket = Old->List[i].load(std::memory_order_relaxed); Bucket != nullptr;
+                Bucket = Bucket->Link.load(std::memory_order_relaxed)) {
+            TLink& Head = Table->List[Table->Sizer.Index(Bucket->Hash)];
+            Head.store(new TRcuBucket<_Tp>(Bucket->Hash,Bucket->Key,Bucket->Value,
+                Head.load(std::memory_order_relaxed)),std::memory_order_relaxed);
+        }
+    }
+    FTable.store(Table,std::memory_order_release);
+    Retire(nullptr,Old);
+    return true;
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TRcuHashList<_Tp,_Sizer,_Hash>::Clear()
+{
+    std::lock_guard<std::mutex> Guard(FWriteLock);
+    TTable* Old = FTable.load(std::memory_order_relaxed);
+    FTable.store(NewTable(Old->Size),std::memory_order_release);
+    FCount.store(0,std::memory_order_relaxed);
+    Retire(nullptr,Old);
+    Reclaim0();
+}
+
+// Call after the item is unlinked: it is stamped with the epoch before
+// Advance(), readers that start later can't reach it
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TRcuHashList<_Tp,_Sizer,_Hash>::Retire(PBucket Bucket, TTable* Table)
+{
+    TRetired Item = { Bucket, Table, TRcuDomain::Instance().Advance() };
+    FRetired.push_back(Item);
+}
+
+// After each write: grow when overloaded, free retired items in batches
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TRcuHashList<_Tp,_Sizer,_Hash>::Written()
+{
+    TTable* Table = FTable.load(std::memory_order_relaxed);
+    if (FMaxLoadFactor > 0 && Count() > Table->Size * FMaxLoadFactor) {
+        Resize0(_Sizer::Grow(Table->Size));
+    }
+    if (FRetired.size() >= RCU_RECLAIM) Reclaim0();
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TRcuHashList<_Tp,_Sizer,_Hash>::Reclaim()
+{
+    std::lock_guard<std::mutex> Guard(FWriteLock);
+    Reclaim0();
+}
+
+// Free the retired buckets and tables no reader can reach any more
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TRcuHashList<_Tp,_Sizer,_Hash>::Reclaim0()
+{
+    uint64_t Min = TRcuDomain::Instance().MinActive();
+    size_t n = 0;
+    for (size_t i = 0; i < FRetired.size(); i++) {
+        if (FRetired[i].Epoch < Min) {
+            if (FRetired[i].Bucket != nullptr) delete FRetired[i].Bucket;
+            if (FRetired[i].Table != nullptr) FreeTable(FRetired[i].Table);
+        } else {
+            FRetired[n++] = FRetired[i];
+        }
+    }
+    FRetired.resize(n);
+}
+
+template <typename _Tp, typename _Sizer, typename _Hash>
+void TRcuHashList<_Tp,_Sizer,_Hash>::GetStatistics(double& density, double& AvgDeeps, int& MaxDeeps) const
+{
+    TRcuReadLock Guard;
+    TTable* Table = FTable.load(std::memory_order_acquire);
+    size_t nBucketLoad = 0;
+    size_t nCount = 0;
+    MaxDeeps = 0;
+    for (size_t i = 0; i < Table->Size; i++) {
+        int nDeeps = 0;
+        for (PBucket Bucket = Table->List[i].load(std::memory_order_acquire); Bucket != nullptr;
+                Bucket = Bucket->Link.load(std::memory_order_acquire)) {
+            nDeeps++;
+        }
+        if (nDeeps > 0) nBucketLoad++;
+        if (nDeeps > MaxDeeps) MaxDeeps = nDeeps;
+        nCount += nDeeps;
+    }
+
+    density = (double)nBucketLoad / Table->Size;
+    AvgDeeps = nBucketLoad > 0 ? (double)nCount / nBucketLoad : 0;
+}
+
+}   // namespace tony
+#endif
@@ -11,7 +11,24 @@
   #define SUPPORT_HASHLIST_CHARPTR_STRDUP   1
 #endif
 
-#include "HashList.h"
+#if defined(WYHASH_VER)
+  #define HASHLIST_HASH     TWyHash
+#else
+  #define HASHLIST_HASH     TFNVHash
+#endif
+
+#if defined(FLAT_VER)
+  #include "FlatHashList.h"
+  #define HASHLIST_CLASS(T) TFlatHashList<T,HASHLIST_HASH>
+#else
+  #include "HashList.h"
+  #define HASHLIST_CLASS(T) THashList<T,TPrimeSize,HASHLIST_HASH>
+#endif
+#include "HashLoader.h"
+#if !defined(FLAT_VER) && !defined(CHARPTR_VER)
+  #include "HashSnapshot.h"
+  #define SNAPSHOT_VER      1
+#endif
 
 using namespace std;
 using namespace tony;
@@ -21,13 +38,15 @@ using namespace tony;
 //#define STRING_VER 1
 //#define CHARPTR_VER 1
 //#define INTEGER_VER 1
+//#define FLAT_VER 1
+//#define WYHASH_VER 1
 
 #if defined(STRING_VER)
-  typedef THashList<string> HashList;
+  typedef HASHLIST_CLASS(string) HashList;
 #elif defined(CHARPTR_VER)
-  typedef THashList<char*>  HashList;
+  typedef HASHLIST_CLASS(char*)  HashList;
 #elif defined(INTEGER_VER)
-  typedef THashList<int>        HashList;
+  typedef HASHLIST_CLASS(int)        HashList;
 #else
   #error Need STRING_VER, CHARPTR_VER or INTEGER_VER to be defined!
 #endif
@@ -55,7 +74,9 @@ static void MemUsage ( )
     }
 }
 
-static void Load(HashList& X, const char *FileName)
+#if defined(CHARPTR_VER)
+// Line by line with fgets(): lines longer than 1023 bytes are split
+static void LoadLines(HashList& X, const char *FileName)
 {
     FILE *fp = fopen(FileName,"r");
     if (fp == NULL) {
@@ -106,6 +127,63 @@ static void Load(HashList& X, const char *FileName)
     printf("Density=%.2f, AvgDeeps=%.2f, MaxDeeps=%d.\n",
             density,avgDeeps,maxDeeps);
 }
+#endif
+
+// Value of a line: the value itself, or its length for INTEGER_VER
+struct TLineValue {
+#if defined(STRING_VER)
+    string operator()(const TKeyRef& Value) const { return string(Value.Data,Value.Size); }
+#elif defined(INTEGER_VER)
+    int operator()(const TKeyRef& Value) const { return Value.Size; }
+#endif
+};
+
+// Load by LoadFile(): mmap and parse with all cores. The table is grown
+// once for the whole file, so with FLAT_VER the -l listing (slot order)
+// and capacity differ from adding line by line.
+static void Load(HashList& X, const char *FileName)
+{
+#if defined(CHARPTR_VER)
+    // Values would need a copy that outlives LoadFile()
+    LoadLines(X,FileName);
+#else
+    TLoadStats Stats;
+    if (!LoadFile(X,FileName,TLineValue(),Stats)) {
+        printf("Can't read file: %s.\n",FileName);
+        return;
+    }
+
+    printf("\nLoad from file [%s]: Adding %zu items, duplicated %zu items.\n",
+            FileName,Stats.Added,Stats.Duplicated);
+
+    double density, avgDeeps;
+    int maxDeeps;
+    X.GetStatistics(density,avgDeeps,maxDeeps);
+    printf("Density=%.2f, AvgDeeps=%.2f, MaxDeeps=%d.\n",
+            density,avgDeeps,maxDeeps);
+#endif
+}
+
+#if defined(SNAPSHOT_VER)
+// *.snap files are snapshots from -s, others are text
+static bool IsSnapshot(const char *FileName)
+{
+    size_t n = strlen(FileName);
+    return n > 5 && strcmp(FileName+n-5,".snap") == 0;
+}
+
+// LoadSnapshot(), false as well for a snapshot of other hash or values
+static bool LoadSnapshotFile(HashList& X, const char *FileName)
+{
+    try {
+        return LoadSnapshot(X,FileName);
+    } catch (runtime_error* e) {
+        printf("%s\n",e->what());
+        delete e;
+        return false;
+    }
+}
+#endif
 
 int main ( int argc, char *argv[] )
 {
@@ -113,10 +191,16 @@ int main ( int argc, char *argv[] )
     gettimeofday(&tv1,NULL);
 {
     bool listflag = false;
+#if defined(SNAPSHOT_VER)
+    const char* snapfile = NULL;
+#endif
     int nth = 1;
-    if (argc > 1 && strcmp(argv[nth],"-l") == 0) {
-        listflag = true;
-        nth++;
+    for (; nth < argc; nth++) {
+        if (strcmp(argv[nth],"-l") == 0) listflag = true;
+    #if defined(SNAPSHOT_VER)
+        else if (strcmp(argv[nth],"-s") == 0 && nth+1 < argc) snapfile = argv[++nth];
+    #endif
+        else break;
     }
     int HashSize = argc > nth ? atoi(argv[nth]) : 5000;
     HashList X(HashSize);
@@ -124,6 +208,12 @@ int main ( int argc, char *argv[] )
 
     if (nth+1 < argc) {
         while (++nth < argc) {
+        #if defined(SNAPSHOT_VER)
+            if (IsSnapshot(argv[nth])) {
+                if (!LoadSnapshotFile(X,argv[nth])) printf("Can't read file: %s.\n",argv[nth]);
+                continue;
+            }
+        #endif
             Load(X,argv[nth]);
         }
     } else {
@@ -147,6 +237,23 @@ int main ( int argc, char *argv[] )
 
     printf("\nHashSize=%zu, Total buckets=%zu.\n",
             X.HashSize(),X.Count());
+#if defined(HASHLIST_STATISTICS) && !defined(FLAT_VER)
+    TStatistics st = X.Statistics();
+    printf("Hits=%llu, Misses=%llu, Inserts=%llu, Deletes=%llu, Evictions=%llu.\n",
+            (unsigned long long)st.Hits,(unsigned long long)st.Misses,
+            (unsigned long long)st.Inserts,(unsigned long long)st.Deletes,
+            (unsigned long long)st.Evictions);
+    printf("Resizes=%llu in %.3fms, ProbeLength:",
+            (unsigned long long)st.Resizes,st.ResizeNanos/1e6);
+    for (int i = 0; i < STAT_PROBE_BINS; i++) printf(" %llu",(unsigned long long)st.ProbeLength[i]);
+    printf("\n");
+#endif
+
+#if defined(SNAPSHOT_VER)
+    if (snapfile != NULL && !SaveSnapshot(X,snapfile)) {
+        printf("Can't write file: %s.\n",snapfile);
+    }
+#endif
 
     if (listflag) {
         printf("\n");
@@ -0,0 +1,371 @@
+// hbench.cc
+// vim: set ts=4 sw=4 et:
+//
+// Workload matrix of THashList against std::unordered_map (and
+// boost::unordered_map when its headers are there), one CSV or JSON row
+// per dataset x container x workload:
+//
+//   insert   Add() every key into an empty table
+//   hit      Find() every key, shuffled
+//   miss     Find() keys that are not there
+//   churn    Delete() then Add() again, shuffled
+//   evict    Add() every key with LimitCount = keys/2 (THashList only),
+//            epClock unless -e scan: epScan is O(n) per eviction
+//   iterate  one pass over the whole table, ops are entries
+//
+// Datasets are the distinct keys of each file (hash.cc's line format) and
+// synthetic "key:N" sets of the -n sizes. Every 16th op is timed alone for
+// the latency percentiles; bytes/entry is the heap growth of insert.
+//
+//   hbench [-f csv|json] [-n size,size,...] [-r repeat] [-e clock|scan] [file ...]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <malloc.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__has_include)
+  #if __has_include(<boost/unordered_map.hpp>)
+    #include <boost/unordered_map.hpp>
+    #define HAVE_BOOST  1
+  #endif
+#endif
+
+#include "HashLoader.h"
+
+using namespace std;
+using namespace tony;
+
+const size_t SAMPLE_EVERY = 16;     // ops between two timed ones
+const unsigned SHUFFLE_SEED = 20150304;
+
+static TEvictPolicy EvictPolicy = epClock;
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Bytes allocated from the heap right now
+static size_t HeapUsed()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+    return (unsigned)mallinfo().uordblks;
+#else
+    return 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Containers, all keyed by string with int values
+//------------------------------------------------------------------------------
+template <typename _Sizer, typename _Hash>
+struct TBenchHashList {
+    THashList<int,_Sizer,_Hash> X;
+    explicit TBenchHashList(size_t LimitCount=0) : X(0,LimitCount) { X.EvictPolicy = EvictPolicy; }
+    static bool CanEvict() { return true; }
+    bool Insert(const string& Key, int Value) { return X.Add(Key,Value); }
+    bool Find(const string& Key) const { return X.Find(Key); }
+    bool Erase(const string& Key) { return X.Delete(Key); }
+    long Iterate() const {
+        long Sum = 0;
+        for (typename THashList<int,_Sizer,_Hash>::const_iterator it = X.begin(); it != X.end(); ++it) {
+            Sum += it->Value;
+        }
+        return Sum;
+    }
+};
+
+template <typename _Map>
+struct TBenchMap {
+    _Map X;
+    explicit TBenchMap(size_t=0) {}
+    static bool CanEvict() { return false; }
+    bool Insert(const string& Key, int Value) { return X.emplace(Key,Value).second; }
+    bool Find(const string& Key) const { return X.find(Key) != X.end(); }
+    bool Erase(const string& Key) { return X.erase(Key) > 0; }
+    long Iterate() const {
+        long Sum = 0;
+        for (typename _Map::const_iterator it = X.begin(); it != X.end(); ++it) {
+            Sum += it->second;
+        }
+        return Sum;
+    }
+};
+
+//------------------------------------------------------------------------------
+// Measurement
+//------------------------------------------------------------------------------
+struct TResult {
+    string      Dataset;
+    size_t      Keys;
+    const char* Container;
+    const char* Workload;
+    size_t      Ops;
+    double      Seconds;
+    double      Pct[4];         // p50, p90, p99, p99.9 in ns, < 0 if none
+    double      BytesPerEntry;  // < 0 if not measured
+};
+
+static const char* PCT_NAMES[4] = { "p50_ns", "p90_ns", "p99_ns", "p999_ns" };
+static const double PCT_RANKS[4] = { 0.50, 0.90, 0.99, 0.999 };
+
+static vector<TResult> Results;
+static volatile long Sink;  // keeps the ops from being optimized away
+
+// Run Op(i) for i in [0, Ops), timing every SAMPLE_EVERY-th one alone
+template <typename _Fn>
+static void Measure(TResult& R, size_t Ops, _Fn Op)
+{
+    vector<long> Samples;
+    Samples.reserve(Ops / SAMPLE_EVERY + 1);
+    long Found = 0;
+    double t = Now();
+    for (size_t i = 0; i < Ops; i++) {
+        if (i % SAMPLE_EVERY == 0) {
+            long t0 = NowNs();
+            Found += Op(i);
+            Samples.push_back(NowNs() - t0);
+        } else {
+            Found += Op(i);
+        }
+    }
+    R.Seconds = Now() - t;
+    R.Ops = Ops;
+    Sink = Sink + Found;
+
+    sort(Samples.begin(),Samples.end());
+    for (int p = 0; p < 4; p++) {
+        R.Pct[p] = Samples.empty() ? -1 : Samples[(size_t)(PCT_RANKS[p] * (Samples.size() - 1))];
+    }
+}
+
+static void Record(TResult& R, int Repeat, const TResult& Run)
+{
+    // Best of the repeats by throughput
+    if (Repeat == 0 || Run.Seconds < R.Seconds) R = Run;
+}
+
+template <typename _Bench>
+static void RunAll(const char* Name, const string& Dataset, const vector<string>& Keys,
+                   const vector<string>& Missing, const vector<size_t>& Order, int Repeats)
+{
+    static const char* WORKLOADS[6] = { "insert", "hit", "miss", "churn", "evict", "iterate" };
+    TResult Best[6];
+    size_t n = Keys.size();
+
+    for (int r = 0; r < Repeats; r++) {
+        TResult R;
+        R.Dataset = Dataset;
+        R.Keys = n;
+        R.Container = Name;
+        R.BytesPerEntry = -1;
+
+        size_t Heap = HeapUsed();
+        _Bench* X = new _Bench();
+        R.Workload = WORKLOADS[0];
+        Measure(R,n,[&](size_t i) { return X->Insert(Keys[i],(int)i); });
+        R.BytesPerEntry = n > 0 ? (double)(HeapUsed() - Heap) / n : 0;
+        Record(Best[0],r,R);
+        R.BytesPerEntry = -1;
+
+        R.Workload = WORKLOADS[1];
+        Measure(R,n,[&](size_t i) { return X->Find(Keys[Order[i]]); });
+        Record(Best[1],r,R);
+
+        R.Workload = WORKLOADS[2];
+        Measure(R,n,[&](size_t i) { return X->Find(Missing[Order[i]]); });
+        Record(Best[2],r,R);
+
+        R.Workload = WORKLOADS[3];
+        Measure(R,2*n,[&](size_t i) {
+            const string& Key = Keys[Order[i/2]];
+            return (i & 1) ? X->Insert(Key,(int)i) : X->Erase(Key);
+        });
+        Record(Best[3],r,R);
+
+        // One pass is one op of Measure(), reported per entry
+        R.Workload = WORKLOADS[5];
+        Measure(R,1,[&](size_t) { return X->Iterate() != 0; });
+        R.Ops = n;
+        for (int p = 0; p < 4; p++) R.Pct[p] = -1;
+        Record(Best[5],r,R);
+        delete X;
+
+        if (_Bench::CanEvict()) {
+            X = new _Bench(n/2 > 0 ? n/2 : 1);
+            R.Workload = WORKLOADS[4];
+            Measure(R,n,[&](size_t i) { return X->Insert(Keys[Order[i]],(int)i); });
+            Record(Best[4],r,R);
+            delete X;
+        }
+    }
+
+    for (int w = 0; w < 6; w++) {
+        if (w == 4 && !_Bench::CanEvict()) continue;
+        Results.push_back(Best[w]);
+    }
+}
+
+static void RunDataset(const string& Dataset, const vector<string>& Keys, int Repeats)
+{
+    vector<string> Missing(Keys.size());
+    for (size_t i = 0; i < Keys.size(); i++) Missing[i] = Keys[i] + "#miss";
+    vector<size_t> Order(Keys.size());
+    unsigned Seed = SHUFFLE_SEED;
+    for (size_t i = 0; i < Order.size(); i++) Order[i] = i;
+    for (size_t i = Order.size(); i > 1; i--) {
+        Seed = Seed * 1103515245 + 12345;
+        swap(Order[i-1],Order[((size_t)Seed << 16 ^ Seed >> 8) % i]);
+    }
+
+    RunAll< TBenchHashList<TPrimeSize,TFNVHash> >("THashList",Dataset,Keys,Missing,Order,Repeats);
+    RunAll< TBenchHashList<TPow2Size,TWyHash> >("THashList<TPow2Size,TWyHash>",Dataset,Keys,Missing,Order,Repeats);
+    RunAll< TBenchMap< unordered_map<string,int> > >("std::unordered_map",Dataset,Keys,Missing,Order,Repeats);
+#if defined(HAVE_BOOST)
+    RunAll< TBenchMap< boost::unordered_map<string,int> > >("boost::unordered_map",Dataset,Keys,Missing,Order,Repeats);
+#endif
+}
+
+// Distinct keys of FileName, in file order
+static bool LoadKeys(const char* FileName, vector<string>& Keys)
+{
+    THashList<int> X;
+    TLoadStats Stats;
+    struct TNoValue { int operator()(const TKeyRef&) const { return 0; } };
+    if (!LoadFile(X,FileName,TNoValue(),Stats)) return false;
+    for (THashList<int>::const_iterator it = X.begin(); it != X.end(); ++it) {
+        Keys.push_back(it->Key);
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Output
+//------------------------------------------------------------------------------
+static void PrintCsv()
+{
+    printf("dataset,keys,container,workload,ops,seconds,mops");
+    for (int p = 0; p < 4; p++) printf(",%s",PCT_NAMES[p]);
+    printf(",bytes_per_entry\n");
+    for (size_t i = 0; i < Results.size(); i++) {
+        const TResult& R = Results[i];
+        printf("%s,%zu,%s,%s,%zu,%.6f,%.3f",R.Dataset.c_str(),R.Keys,R.Container,R.Workload,
+                R.Ops,R.Seconds,R.Seconds > 0 ? R.Ops / R.Seconds / 1e6 : 0);
+        for (int p = 0; p < 4; p++) {
+            if (R.Pct[p] < 0) printf(","); else printf(",%.0f",R.Pct[p]);
+        }
+        if (R.BytesPerEntry < 0) printf(",\n"); else printf(",%.1f\n",R.BytesPerEntry);
+    }
+}
+
+// S as the inside of a JSON string: '"', '\' and control characters escaped
+static string JsonEscape(const string& S)
+{
+    string Result;
+    for (size_t i = 0; i < S.size(); i++) {
+        unsigned char c = S[i];
+        if (c == '"' || c == '\\') {
+            Result += '\\';
+            Result += c;
+        } else if (c < ' ') {
+            char buf[8];
+            snprintf(buf,sizeof(buf),"\\u%04x",c);
+            Result += buf;
+        } else {
+            Result += c;
+        }
+    }
+    return Result;
+}
+
+static void PrintJson()
+{
+    printf("[\n");
+    for (size_t i = 0; i < Results.size(); i++) {
+        const TResult& R = Results[i];
+        printf("  {\"dataset\":\"%s\",\"keys\":%zu,\"container\":\"%s\",\"workload\":\"%s\","
+                "\"ops\":%zu,\"seconds\":%.6f,\"mops\":%.3f",JsonEscape(R.Dataset).c_str(),R.Keys,R.Container,
+                R.Workload,R.Ops,R.Seconds,R.Seconds > 0 ? R.Ops / R.Seconds / 1e6 : 0);
+        for (int p = 0; p < 4; p++) {
+            if (R.Pct[p] < 0) printf(",\"%s\":null",PCT_NAMES[p]);
+            else printf(",\"%s\":%.0f",PCT_NAMES[p],R.Pct[p]);
+        }
+        if (R.BytesPerEntry < 0) printf(",\"bytes_per_entry\":null}");
+        else printf(",\"bytes_per_entry\":%.1f}",R.BytesPerEntry);
+        printf("%s\n",i+1 < Results.size() ? "," : "");
+    }
+    printf("]\n");
+}
+
+int main ( int argc, char *argv[] )
+{
+    bool json = false;
+    int Repeats = 1;
+    string Sizes = "10000,100000,1000000";
+    int nth = 1;
+    for (; nth+1 < argc && argv[nth][0] == '-'; nth += 2) {
+        if (strcmp(argv[nth],"-f") == 0) json = strcmp(argv[nth+1],"json") == 0;
+        else if (strcmp(argv[nth],"-n") == 0) Sizes = argv[nth+1];
+        else if (strcmp(argv[nth],"-r") == 0) Repeats = atoi(argv[nth+1]);
+        else if (strcmp(argv[nth],"-e") == 0) EvictPolicy = strcmp(argv[nth+1],"scan") == 0 ? epScan : epClock;
+        else break;
+    }
+    // -n: sizes, separated by ','
+    vector<size_t> Counts;
+    bool Bad = nth < argc && argv[nth][0] == '-';
+    for (const char* p = Sizes.c_str(); !Bad && *p != 0; ) {
+        char* e;
+        size_t n = strtoul(p,&e,10);
+        Bad = e == p || (*e != ',' && *e != 0);
+        p = e;
+        while (*p == ',') p++;
+        if (n > 0) Counts.push_back(n);
+    }
+    if (Bad) {
+        fprintf(stderr,"Usage: %s [-f csv|json] [-n size,size,...] [-r repeat] [-e clock|scan] [file ...]\n",argv[0]);
+        return 1;
+    }
+    if (Repeats < 1) Repeats = 1;
+
+    for (; nth < argc; nth++) {
+        vector<string> Keys;
+        if (!LoadKeys(argv[nth],Keys)) {
+            fprintf(stderr,"Can't read file: %s.\n",argv[nth]);
+            return 1;
+        }
+        RunDataset(argv[nth],Keys,Repeats);
+    }
+
+    for (size_t c = 0; c < Counts.size(); c++) {
+        size_t n = Counts[c];
+        vector<string> Keys(n);
+        char buf[32];
+        for (size_t i = 0; i < n; i++) {
+            snprintf(buf,sizeof(buf),"key:%zu",i);
+            Keys[i] = buf;
+        }
+        snprintf(buf,sizeof(buf),"synthetic-%zu",n);
+        RunDataset(buf,Keys,Repeats);
+    }
+
+    if (json) PrintJson(); else PrintCsv();
+    return 0;
+}
@@ -0,0 +1,116 @@
+// hconc.cc
+// vim: set ts=4 sw=4 et:
+//
+// Mixed Find/Increment throughput of TConcurrentHashList and TRcuHashList
+// against one THashList behind a global mutex, for 1, 2, 4 ... threads.
+//
+//   hconc [-t maxThreads] [-r readPercent] [-k keys] [-n opsPerThread]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+
+#include "ConcurrentHashList.h"
+#include "RcuHashList.h"
+
+using namespace std;
+using namespace tony;
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// THashList with one lock: what callers do today
+class TLockedHashList {
+    public:
+        bool Find(const TKeyRef& Key) const {
+            lock_guard<mutex> Guard(FLock);
+            return FList.Find(Key);
+        }
+        bool Increment(const TKeyRef& Key) {
+            lock_guard<mutex> Guard(FLock);
+            return FList.Increment(Key);
+        }
+        size_t Count() const { return FList.Count(); }
+    private:
+        mutable mutex   FLock;
+        THashList<int>  FList;
+};
+
+static vector<string> Keys;
+static int ReadPercent = 90;
+static long OpsPerThread = 2000000;
+
+template <typename _List>
+static void Worker(_List& X, unsigned Seed, long& Hits)
+{
+    long Found = 0;
+    for (long i = 0; i < OpsPerThread; i++) {
+        Seed = Seed * 1103515245 + 12345;
+        const string& Key = Keys[(Seed >> 8) % Keys.size()];
+        if ((long)((Seed >> 4) % 100) < ReadPercent) {
+            Found += X.Find(Key);
+        } else {
+            X.Increment(Key);
+        }
+    }
+    Hits = Found;
+}
+
+template <typename _List>
+static double Run(_List& X, int Threads)
+{
+    vector<thread> Workers;
+    vector<long> Hits(Threads);
+    double t = Now();
+    for (int i = 0; i < Threads; i++) {
+        Workers.push_back(thread(Worker<_List>,ref(X),(unsigned)(i+1)*7919,ref(Hits[i])));
+    }
+    for (int i = 0; i < Threads; i++) Workers[i].join();
+    t = Now() - t;
+    return Threads * OpsPerThread / t / 1000000;
+}
+
+int main ( int argc, char *argv[] )
+{
+    int maxThreads = thread::hardware_concurrency();
+    int nKeys = 1000000;
+    for (int nth = 1; nth+1 < argc; nth += 2) {
+        if (strcmp(argv[nth],"-t") == 0) maxThreads = atoi(argv[nth+1]);
+        else if (strcmp(argv[nth],"-r") == 0) ReadPercent = atoi(argv[nth+1]);
+        else if (strcmp(argv[nth],"-k") == 0) nKeys = atoi(argv[nth+1]);
+        else if (strcmp(argv[nth],"-n") == 0) OpsPerThread = atol(argv[nth+1]);
+    }
+    if (maxThreads < 1) maxThreads = 1;
+
+    char buf[32];
+    for (int i = 0; i < nKeys; i++) {
+        snprintf(buf,sizeof(buf),"key:%d",i);
+        Keys.push_back(buf);
+    }
+
+    printf("\n%d keys, %d%% Find / %d%% Increment, %ld ops per thread, %u cores.\n\n",
+            nKeys,ReadPercent,100-ReadPercent,OpsPerThread,thread::hardware_concurrency());
+    printf("Threads  TConcurrentHashList  TRcuHashList  THashList+mutex   (Mops/s)\n");
+    for (int Threads = 1; ; Threads = Threads*2 < maxThreads ? Threads*2 : maxThreads) {
+        TConcurrentHashList<int> X(nKeys);
+        TRcuHashList<int> Z(nKeys);
+        TLockedHashList Y;
+        double a = Run(X,Threads);
+        double c = Run(Z,Threads);
+        double b = Run(Y,Threads);
+        printf("%7d  %19.2f  %12.2f  %15.2f\n",Threads,a,c,b);
+        if (Threads == maxThreads) break;
+    }
+
+    printf("\n");
+    return 0;
+}
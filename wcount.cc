@@ -0,0 +1,153 @@
+// wcount.cc
+// vim: set ts=4 sw=4 et:
+//
+// Word frequency counting: THashList<int>::Increment() against
+// std::unordered_map<string,int>, keys/sec over the same words.
+//
+//   wcount [-n top] file ...
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include "HashList.h"
+
+using namespace std;
+using namespace tony;
+
+struct TWord {
+    const char* Data;
+    size_t      Size;
+};
+
+static double Now()
+{
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+// Whole file appended to Text, words are split on bytes <= ' '
+static bool Load(string& Text, const char *FileName)
+{
+    FILE *fp = fopen(FileName,"r");
+    if (fp == NULL) {
+        printf("Can't read file: %s.\n",FileName);
+        return false;
+    }
+
+    char buf[64*1024];
+    size_t n;
+    while ((n = fread(buf,1,sizeof(buf),fp)) > 0) {
+        Text.append(buf,n);
+    }
+    Text.push_back('\n');
+
+    fclose(fp);
+    return true;
+}
+
+static void Split(const string& Text, vector<TWord>& Words)
+{
+    const char* p = Text.data();
+    const char* e = p + Text.size();
+    while (p < e) {
+        while (p < e && (unsigned char)*p <= ' ') p++;
+        const char* t = p;
+        while (p < e && (unsigned char)*p > ' ') p++;
+        if (p > t) {
+            TWord w = { t, (size_t)(p - t) };
+            Words.push_back(w);
+        }
+    }
+}
+
+template <typename _List>
+static void CountBy(const char* Name, const vector<TWord>& Words, _List& X)
+{
+    double t = Now();
+    for (size_t i = 0; i < Words.size(); i++) {
+        X.Increment(TKeyRef(Words[i].Data,Words[i].Size));
+    }
+    t = Now() - t;
+
+    double density, avgDeeps;
+    int maxDeeps;
+    X.GetStatistics(density,avgDeeps,maxDeeps);
+    printf("%-28s %8.3fs %7.2f Mkeys/s, %zu distinct (HashSize=%zu, AvgDeeps=%.2f, MaxDeeps=%d)\n",
+            Name,t,Words.size()/t/1000000,X.Count(),X.HashSize(),avgDeeps,maxDeeps);
+}
+
+static void CountByStd(const char* Name, const vector<TWord>& Words)
+{
+    unordered_map<string,int> X;
+    double t = Now();
+    for (size_t i = 0; i < Words.size(); i++) {
+        X[string(Words[i].Data,Words[i].Size)]++;
+    }
+    t = Now() - t;
+
+    printf("%-28s %8.3fs %7.2f Mkeys/s, %zu distinct (bucket_count=%zu)\n",
+            Name,t,Words.size()/t/1000000,X.size(),X.bucket_count());
+}
+
+typedef THashList<int> HashList;
+typedef THashList<int,TPow2Size,TWyHash> WyHashList;
+
+struct TByCount {
+    const HashList* X;
+    bool operator()(int a, int b) const { return X->Values(a) > X->Values(b); }
+};
+
+int main ( int argc, char *argv[] )
+{
+    int top = 0;
+    int nth = 1;
+    if (argc > nth+1 && strcmp(argv[nth],"-n") == 0) {
+        top = atoi(argv[nth+1]);
+        nth += 2;
+    }
+    if (nth >= argc) {
+        printf("Usage: %s [-n top] file ...\n",argv[0]);
+        return 1;
+    }
+
+    string Text;
+    while (nth < argc) {
+        if (!Load(Text,argv[nth++])) return 1;
+    }
+    vector<TWord> Words;
+    Split(Text,Words);
+    printf("\n%zu bytes, %zu words.\n\n",Text.size(),Words.size());
+
+    HashList X(5000);
+    X.max_load_factor(1,2,20);
+    CountBy("THashList<int>",Words,X);
+
+    WyHashList Y(5000);
+    Y.max_load_factor(1,2,20);
+    CountBy("THashList<TPow2Size,TWyHash>",Words,Y);
+
+    CountByStd("std::unordered_map",Words);
+
+    if (top > 0) {
+        vector<int> Index(X.Count());
+        for (size_t i = 0; i < Index.size(); i++) Index[i] = i;
+        TByCount ByCount = { &X };
+        if (top > (int)Index.size()) top = Index.size();
+        partial_sort(Index.begin(),Index.begin()+top,Index.end(),ByCount);
+
+        printf("\n");
+        for (int i = 0; i < top; i++) {
+            printf("%8d %s\n",X.Values(Index[i]),X.Keys(Index[i]).c_str());
+        }
+    }
+
+    printf("\n");
+    return 0;
+}